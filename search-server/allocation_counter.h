@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+
+// Возвращает кол-во вызовов глобального operator new с начала работы программы.
+// Считающие operator new/delete определены в allocation_counter.cpp, в отдельной единице
+// трансляции: так компилятор не встраивает их в вызывающий код и не принимает free
+// для указателя от operator new за несогласованное освобождение
+size_t GetAllocationCount();
@@ -0,0 +1,116 @@
+#include "async_search_server.h"
+
+#include <algorithm>
+
+using namespace std;
+
+AsyncSearchServer::AsyncSearchServer(const SearchServer& search_server)
+    : AsyncSearchServer(search_server, Options{}) {
+}
+
+AsyncSearchServer::AsyncSearchServer(const SearchServer& search_server, Options options)
+    : search_server_(search_server)
+    , max_in_flight_(options.max_in_flight) {
+    const size_t thread_count = options.thread_count > 0
+        ? options.thread_count : max<size_t>(thread::hardware_concurrency(), 1);
+    threads_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this] {
+            RunWorker();
+        });
+    }
+}
+
+// Выполняет принятые запросы и останавливает потоки, чтобы ни одна future не осталась
+// без результата
+AsyncSearchServer::~AsyncSearchServer() {
+    {
+        lock_guard guard(mutex_);
+        is_stopping_ = true;
+    }
+    task_added_.notify_all();
+    for (thread& worker_thread : threads_) {
+        worker_thread.join();
+    }
+}
+
+// Поиск документов с заданным статусом. Исключения разбора запроса передаются через future
+future<vector<Document>> AsyncSearchServer::FindTopDocuments(string raw_query, DocumentStatus status,
+    size_t max_count) {
+    return Submit([this, raw_query = move(raw_query), status, max_count] {
+        return search_server_.FindTopDocuments(raw_query, status, max_count);
+    });
+}
+
+// Поиск документов с заданным статусом в пределах бюджета
+future<SearchResult> AsyncSearchServer::FindTopDocuments(string raw_query, SearchBudget budget,
+    DocumentStatus status, size_t max_count) {
+    return Submit([this, raw_query = move(raw_query), budget, status, max_count] {
+        return search_server_.FindTopDocuments(raw_query, budget, status, max_count);
+    });
+}
+
+// Сверяет запрос с документом
+future<SearchServer::MatchResult> AsyncSearchServer::MatchDocument(string raw_query, int document_id) {
+    return Submit([this, raw_query = move(raw_query), document_id] {
+        return search_server_.MatchDocument(raw_query, document_id);
+    });
+}
+
+// Возвращает кол-во принятых и еще не выполненных запросов
+size_t AsyncSearchServer::GetInFlightCount() const {
+    lock_guard guard(mutex_);
+    return in_flight_count_;
+}
+
+// Возвращает кол-во запросов, отклоненных из-за заполненной очереди
+size_t AsyncSearchServer::GetRejectedCount() const {
+    lock_guard guard(mutex_);
+    return rejected_count_;
+}
+
+// Ставит задачу в очередь либо бросает QueryRejectedError. Запрос считается выполняющимся
+// с момента приема до готовности его результата, так что ограничение действует на очередь
+// и выполняемые запросы вместе
+void AsyncSearchServer::Enqueue(function<void()> task) {
+    {
+        lock_guard guard(mutex_);
+        if (is_stopping_) {
+            throw QueryRejectedError("Search server is stopping");
+        }
+        if (in_flight_count_ >= max_in_flight_) {
+            ++rejected_count_;
+            throw QueryRejectedError("Too many queries in flight");
+        }
+        // Место занимается после вставки: если вставка бросит исключение, счетчик не изменится
+        tasks_.push_back(move(task));
+        ++in_flight_count_;
+    }
+    task_added_.notify_one();
+}
+
+void AsyncSearchServer::RunWorker() {
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock lock(mutex_);
+            task_added_.wait(lock, [this] {
+                return is_stopping_ || !tasks_.empty();
+            });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        // Исключения задачи сохраняются в ее future, место запроса задача освобождает сама
+        task();
+    }
+}
+
+// Освобождает место выполненного запроса. Вызывается задачей до публикации результата
+void AsyncSearchServer::ReleaseSlot() {
+    lock_guard guard(mutex_);
+    --in_flight_count_;
+}
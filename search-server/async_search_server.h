@@ -0,0 +1,147 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "search_budget.h"
+#include "search_server.h"
+
+// Исключение, которым AsyncSearchServer отклоняет запрос при заполненной очереди
+class QueryRejectedError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Асинхронный поиск: запросы выполняются в пуле потоков, принадлежащем объекту,
+// а вызывающий сразу получает std::future с результатом. Кол-во принятых и еще не выполненных
+// запросов ограничено: при заполнении новый запрос отклоняется исключением QueryRejectedError,
+// и вызывающий сам решает, повторить его позже или вернуть клиенту ошибку.
+// Сервер должен жить дольше объекта и не меняться, пока выполняются запросы; для поиска
+// одновременно с изменениями задачи Submit могут закреплять версию ConcurrentSearchServer.
+// Методы потокобезопасны
+class AsyncSearchServer {
+public:
+    struct Options {
+        size_t thread_count = 0;       // Кол-во потоков поиска, 0 - по числу ядер
+        size_t max_in_flight = 1024;   // Наибольшее кол-во принятых и не выполненных запросов
+    };
+
+    explicit AsyncSearchServer(const SearchServer& search_server);
+    AsyncSearchServer(const SearchServer& search_server, Options options);
+
+    AsyncSearchServer(const AsyncSearchServer&) = delete;
+    AsyncSearchServer& operator=(const AsyncSearchServer&) = delete;
+
+    // Выполняет принятые запросы и останавливает потоки
+    ~AsyncSearchServer();
+
+    // Поиск документов с заданным статусом. Исключения разбора запроса передаются через future.
+    // Бросает QueryRejectedError, если очередь заполнена
+    std::future<std::vector<Document>> FindTopDocuments(std::string raw_query,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    // Поиск документов по предикату. Предикат вызывается в потоках поиска
+    template <typename DocumentPredicate>
+    std::future<std::vector<Document>> FindTopDocuments(std::string raw_query,
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    // Поиск документов с заданным статусом в пределах бюджета. Ожидание в очереди расходует
+    // deadline бюджета, а search_timeout отсчитывается от начала выполнения запроса. Бросает QueryRejectedError, если очередь заполнена
+    std::future<SearchResult> FindTopDocuments(std::string raw_query, SearchBudget budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT);
+
+    // Сверяет запрос с документом. Бросает QueryRejectedError, если очередь заполнена
+    std::future<SearchServer::MatchResult> MatchDocument(std::string raw_query, int document_id);
+
+    // Выполняет function() в потоке поиска и возвращает future с ее результатом.
+    // Бросает QueryRejectedError, если очередь заполнена
+    template <typename Function>
+    std::future<std::invoke_result_t<Function>> Submit(Function function);
+
+    // Возвращает кол-во принятых и еще не выполненных запросов
+    size_t GetInFlightCount() const;
+
+    // Возвращает кол-во запросов, отклоненных из-за заполненной очереди
+    size_t GetRejectedCount() const;
+
+private:
+    const SearchServer& search_server_;
+    size_t max_in_flight_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable task_added_;
+    std::deque<std::function<void()>> tasks_;
+    size_t in_flight_count_ = 0;
+    size_t rejected_count_ = 0;
+    bool is_stopping_ = false;
+
+    std::vector<std::thread> threads_;
+
+    // Ставит задачу в очередь либо бросает QueryRejectedError
+    void Enqueue(std::function<void()> task);
+
+    // Освобождает место выполненного запроса. Вызывается задачей до публикации результата
+    void ReleaseSlot();
+
+    void RunWorker();
+};
+
+// Поиск документов по предикату. Предикат вызывается в потоках поиска
+template <typename DocumentPredicate>
+std::future<std::vector<Document>> AsyncSearchServer::FindTopDocuments(std::string raw_query,
+    DocumentPredicate document_predicate, size_t max_count) {
+    return Submit([this, raw_query = std::move(raw_query), document_predicate, max_count] {
+        return search_server_.FindTopDocuments(raw_query, document_predicate, max_count);
+    });
+}
+
+// Выполняет function() в потоке поиска и возвращает future с ее результатом.
+// Место запроса освобождается до публикации результата: вызывающий, дождавшийся его,
+// может сразу отправить следующий запрос, не упираясь в max_in_flight.
+// Очередь хранит копируемые задачи, поэтому функция и promise лежат в общем состоянии
+template <typename Function>
+std::future<std::invoke_result_t<Function>> AsyncSearchServer::Submit(Function function) {
+    using Result = std::invoke_result_t<Function>;
+    struct TaskState {
+        Function function;
+        std::promise<Result> promise;
+    };
+    auto state = std::make_shared<TaskState>(TaskState{ std::move(function), {} });
+    auto result = state->promise.get_future();
+    Enqueue([this, state] {
+        bool is_released = false;
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                state->function();
+                is_released = true;
+                ReleaseSlot();
+                state->promise.set_value();
+            }
+            else {
+                Result value = state->function();
+                is_released = true;
+                ReleaseSlot();
+                state->promise.set_value(std::move(value));
+            }
+        }
+        catch (...) {
+            if (!is_released) {
+                ReleaseSlot();
+            }
+            state->promise.set_exception(std::current_exception());
+        }
+    });
+    return result;
+}
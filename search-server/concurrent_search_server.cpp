@@ -0,0 +1,230 @@
+#include "concurrent_search_server.h"
+
+#include <algorithm>
+#include <cassert>
+#include <exception>
+#include <thread>
+
+using namespace std;
+
+#ifndef NDEBUG
+namespace {
+
+// Серверы, закрепленные текущим потоком, по одному элементу на закрепление. Закрепление,
+// перемещенное в другой поток, при уничтожении там просто не находится в списке
+thread_local vector<const ConcurrentSearchServer*> thread_pins;
+
+} // namespace
+#endif
+
+ConcurrentSearchServer::PinnedServer::PinnedServer(const ConcurrentSearchServer& owner)
+    : owner_(&owner)
+    , stripe_(hash<thread::id>{}(this_thread::get_id()) % ReadIndicator::STRIPE_COUNT) {
+    // Регистрация предшествует чтению опубликованной версии: писатель, сменивший ее,
+    // дождется этого читателя, прежде чем менять старую
+    version_index_ = owner.version_index_.load();
+    owner.read_indicators_[version_index_].Arrive(stripe_);
+    server_ = owner.servers_[owner.published_.load()];
+#ifndef NDEBUG
+    thread_pins.push_back(owner_);
+#endif
+}
+
+ConcurrentSearchServer::PinnedServer::PinnedServer(PinnedServer&& other) noexcept
+    : owner_(other.owner_)
+    , server_(other.server_)
+    , version_index_(other.version_index_)
+    , stripe_(other.stripe_) {
+    other.owner_ = nullptr;
+}
+
+ConcurrentSearchServer::PinnedServer::~PinnedServer() {
+    if (owner_ != nullptr) {
+#ifndef NDEBUG
+        const auto pin = find(thread_pins.begin(), thread_pins.end(), owner_);
+        if (pin != thread_pins.end()) {
+            thread_pins.erase(pin);
+        }
+#endif
+        owner_->Unpin(version_index_, stripe_);
+    }
+}
+
+const SearchServer& ConcurrentSearchServer::PinnedServer::operator*() const {
+    return *server_;
+}
+
+const SearchServer* ConcurrentSearchServer::PinnedServer::operator->() const {
+    return server_;
+}
+
+// Создает обе версии индекса вызовом make_server, например загрузкой одного снимка
+ConcurrentSearchServer::ConcurrentSearchServer(const function<SearchServer()>& make_server)
+    : left_(make_server())
+    , right_(make_server()) {
+}
+
+// Закрепляет текущую версию индекса для чтения. Не блокируется
+ConcurrentSearchServer::PinnedServer ConcurrentSearchServer::Pin() const {
+    return PinnedServer(*this);
+}
+
+// Возвращает кол-во документов в текущей версии индекса
+int ConcurrentSearchServer::GetDocumentCount() const {
+    return Pin()->GetDocumentCount();
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, string_view document, DocumentStatus status,
+    const vector<int>& ratings) {
+    const auto add = [&](SearchServer& server) {
+        server.AddDocument(document_id, document, status, ratings);
+    };
+    Modify(add, add);
+}
+
+void ConcurrentSearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    // При ошибке пакет добавлен частично: вторая версия получает ровно добавленное начало пакета
+    exception_ptr error;
+    size_t added_count = 0;
+    Modify(
+        [&](SearchServer& server) {
+            const int document_count = server.GetDocumentCount();
+            try {
+                server.AddDocuments(documents);
+            }
+            catch (...) {
+                error = current_exception();
+            }
+            added_count = static_cast<size_t>(server.GetDocumentCount() - document_count);
+        },
+        [&](SearchServer& server) {
+            if (added_count == documents.size()) {
+                server.AddDocuments(documents);
+            }
+            else {
+                server.AddDocuments({ documents.begin(), documents.begin() + added_count });
+            }
+        });
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    const auto remove = [&](SearchServer& server) {
+        server.RemoveDocument(document_id);
+    };
+    Modify(remove, remove);
+}
+
+void ConcurrentSearchServer::RemoveDocument(const execution::sequenced_policy&, int document_id) {
+    RemoveDocument(document_id);
+}
+
+void ConcurrentSearchServer::RemoveDocument(const execution::parallel_policy&, int document_id) {
+    const auto remove = [&](SearchServer& server) {
+        server.RemoveDocument(execution::par, document_id);
+    };
+    Modify(remove, remove);
+}
+
+// Подключает журнал изменений к обеим версиям индекса. Каждое изменение записывается в журнал один раз
+void ConcurrentSearchServer::AttachMutationLog(MutationLog* mutation_log) {
+    Modify(
+        [&](SearchServer& server) {
+            server.AttachMutationLog(mutation_log);
+        },
+        [&](SearchServer& server) {
+            server.AttachMutationLog(mutation_log);
+            server.mutation_log_ = nullptr;
+            mutation_log_ = mutation_log;
+        });
+}
+
+void ConcurrentSearchServer::ReadIndicator::Arrive(size_t stripe) {
+    stripes_[stripe].reader_count.fetch_add(1);
+}
+
+void ConcurrentSearchServer::ReadIndicator::Depart(size_t stripe) {
+    stripes_[stripe].reader_count.fetch_sub(1);
+}
+
+bool ConcurrentSearchServer::ReadIndicator::IsEmpty() const {
+    for (const Stripe& stripe : stripes_) {
+        if (stripe.reader_count.load() != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Применяет apply к неопубликованной версии с подключенным журналом и публикует ее, затем,
+// дождавшись ухода читателей старой версии, применяет к ней replay без журнала
+template <typename Apply, typename Replay>
+void ConcurrentSearchServer::Modify(Apply apply, Replay replay) {
+#ifndef NDEBUG
+    assert(find(thread_pins.begin(), thread_pins.end(), this) == thread_pins.end()
+        && "The thread modifies a ConcurrentSearchServer while holding its PinnedServer");
+#endif
+    lock_guard lock(write_mutex_);
+    const int published = published_.load();
+    SearchServer& next = *servers_[1 - published];
+    SearchServer& previous = *servers_[published];
+
+    next.mutation_log_ = mutation_log_;
+    try {
+        apply(next);
+    }
+    catch (...) {
+        next.mutation_log_ = nullptr;
+        throw;
+    }
+    next.mutation_log_ = nullptr;
+
+    Publish(1 - published);
+    replay(previous);
+    previous.log_sequence_ = next.log_sequence_;
+}
+
+// Делает версию servers_[server_index] текущей и ждет, пока старую не покинут все читатели
+void ConcurrentSearchServer::Publish(int server_index) {
+    published_.store(server_index);
+
+    // Сначала ждем читателей, зарегистрированных под следующим номером еще до прошлой публикации,
+    // затем переключаем номер и ждем ушедших под старым. Новые читатели при этом не ждут
+    const int previous_version = version_index_.load();
+    const int next_version = 1 - previous_version;
+    WaitForReaders(next_version);
+    version_index_.store(next_version);
+    WaitForReaders(previous_version);
+}
+
+// Ждет, пока опустеет индикатор читателей. Запросы обычно короткие, поэтому писатель сначала
+// уступает процессор, а не дождавшись - засыпает до ухода очередного читателя
+void ConcurrentSearchServer::WaitForReaders(int version_index) {
+    const ReadIndicator& indicator = read_indicators_[version_index];
+    for (int attempt = 0; attempt < SPIN_COUNT; ++attempt) {
+        if (indicator.IsEmpty()) {
+            return;
+        }
+        this_thread::yield();
+    }
+
+    // Флаг поднимается до проверки индикатора, а читатель проверяет флаг после ухода,
+    // поэтому либо писатель увидит уход, либо читатель разбудит писателя
+    unique_lock lock(drain_mutex_);
+    is_writer_waiting_.store(true);
+    readers_departed_.wait(lock, [&indicator] {
+        return indicator.IsEmpty();
+    });
+    is_writer_waiting_.store(false);
+}
+
+// Снимает закрепление читателя и будит ждущего писателя
+void ConcurrentSearchServer::Unpin(int version_index, size_t stripe) const {
+    read_indicators_[version_index].Depart(stripe);
+    if (is_writer_waiting_.load()) {
+        lock_guard lock(drain_mutex_);
+        readers_departed_.notify_all();
+    }
+}
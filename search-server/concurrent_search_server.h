@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "search_server.h"
+
+// Сервер, который читается из любого числа потоков одновременно с изменениями.
+// Хранит две версии индекса (алгоритм Left-Right): читатели закрепляют опубликованную версию
+// и работают с ней без блокировок, писатель меняет вторую, атомарно публикует ее и, дождавшись
+// ухода читателей старой версии, повторяет на ней то же изменение. Запросы не ждут записи
+// и всегда видят согласованный индекс, но память под индекс и работа записи удваиваются.
+// Писатели выполняются по одному.
+//
+// Закрепление версии (PinnedServer) должно быть коротким, на время одного запроса или пакета:
+// каждое изменение индекса ждет, пока старую версию не покинут все закрепившие ее читатели,
+// поэтому долго живущее закрепление останавливает всех писателей. Поток, держащий закрепление,
+// не должен менять сервер: изменение ждало бы снятия его же закрепления вечно. В отладочной
+// сборке такая запись останавливается assert
+class ConcurrentSearchServer {
+public:
+    // Закрепленная версия индекса. Пока объект жив, сервер, на который он указывает, не меняется,
+    // и string_view из MatchDocument и GetWordFrequencies остаются действительными.
+    // Изменения сервера ждут уничтожения объекта, см. описание класса
+    class PinnedServer {
+    public:
+        PinnedServer(PinnedServer&& other) noexcept;
+        PinnedServer& operator=(PinnedServer&&) = delete;
+        PinnedServer(const PinnedServer&) = delete;
+        PinnedServer& operator=(const PinnedServer&) = delete;
+
+        ~PinnedServer();
+
+        const SearchServer& operator*() const;
+        const SearchServer* operator->() const;
+
+    private:
+        friend class ConcurrentSearchServer;
+
+        PinnedServer(const ConcurrentSearchServer& owner);
+
+        const ConcurrentSearchServer* owner_;
+        const SearchServer* server_ = nullptr;
+        int version_index_ = 0;
+        size_t stripe_ = 0;
+    };
+
+    // Создает обе версии индекса вызовом make_server, например загрузкой одного снимка
+    explicit ConcurrentSearchServer(const std::function<SearchServer()>& make_server);
+
+    ConcurrentSearchServer(const ConcurrentSearchServer&) = delete;
+    ConcurrentSearchServer& operator=(const ConcurrentSearchServer&) = delete;
+
+    // Закрепляет текущую версию индекса для чтения. Не блокируется. Пока закрепление живо,
+    // текущий поток не должен менять сервер
+    PinnedServer Pin() const;
+
+    // Поиск по текущей версии индекса с теми же аргументами, что у SearchServer::FindTopDocuments
+    template <typename... Args>
+    std::vector<Document> FindTopDocuments(Args&&... args) const;
+
+    // Возвращает кол-во документов в текущей версии индекса
+    int GetDocumentCount() const;
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    void RemoveDocument(int document_id);
+
+    void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
+
+    void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+
+    // Подключает журнал изменений к обеим версиям индекса, см. SearchServer::AttachMutationLog.
+    // Каждое изменение записывается в журнал один раз
+    void AttachMutationLog(MutationLog* mutation_log);
+
+private:
+    // Счетчик читателей версии, разнесенный по строкам кэша, чтобы потоки не делили одну строку
+    class ReadIndicator {
+    public:
+        static const size_t STRIPE_COUNT = 16;
+
+        void Arrive(size_t stripe);
+        void Depart(size_t stripe);
+        bool IsEmpty() const;
+
+    private:
+        struct alignas(64) Stripe {
+            std::atomic<int> reader_count{ 0 };
+        };
+        std::array<Stripe, STRIPE_COUNT> stripes_;
+    };
+
+    SearchServer left_;
+    SearchServer right_;
+    std::array<SearchServer*, 2> servers_{ &left_, &right_ };
+
+    // Индекс в servers_ версии, которую закрепляют новые читатели
+    std::atomic<int> published_{ 0 };
+
+    // Читатели регистрируются в индикаторе с номером version_index_. Писатель переключает номер
+    // и ждет опустошения обоих индикаторов, так что ни один читатель не остается на старой версии
+    std::atomic<int> version_index_{ 0 };
+    mutable std::array<ReadIndicator, 2> read_indicators_;
+
+    std::mutex write_mutex_;
+    MutationLog* mutation_log_ = nullptr;
+
+    // Писатель, не дождавшийся ухода читателей за SPIN_COUNT уступок процессора, засыпает
+    // на readers_departed_, а уходящий читатель будит его, если is_writer_waiting_
+    static const int SPIN_COUNT = 64;
+    mutable std::mutex drain_mutex_;
+    mutable std::condition_variable readers_departed_;
+    mutable std::atomic<bool> is_writer_waiting_{ false };
+
+    // Применяет apply к неопубликованной версии с подключенным журналом и публикует ее, затем,
+    // дождавшись ухода читателей старой версии, применяет к ней replay без журнала.
+    // Исключение из apply должно означать, что версия не изменилась: тогда публикации нет
+    template <typename Apply, typename Replay>
+    void Modify(Apply apply, Replay replay);
+
+    // Делает версию servers_[server_index] текущей и ждет, пока старую не покинут все читатели
+    void Publish(int server_index);
+
+    // Ждет, пока опустеет индикатор читателей read_indicators_[version_index]
+    void WaitForReaders(int version_index);
+
+    // Снимает закрепление читателя и будит ждущего писателя
+    void Unpin(int version_index, size_t stripe) const;
+};
+
+// Поиск по текущей версии индекса с теми же аргументами, что у SearchServer::FindTopDocuments
+template <typename... Args>
+std::vector<Document> ConcurrentSearchServer::FindTopDocuments(Args&&... args) const {
+    return Pin()->FindTopDocuments(std::forward<Args>(args)...);
+}
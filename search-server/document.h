@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
+#include <vector>
 
 // Структура документа для поискового сервера
 struct Document {
@@ -20,4 +22,12 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// Документ, добавляемый на сервер пакетом
+struct NewDocument {
+    int id = 0;
+    std::string_view text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
 std::ostream& operator<<(std::ostream& os, const Document& doc);
\ No newline at end of file
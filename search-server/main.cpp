@@ -1,7 +1,9 @@
+#include "allocation_counter.h"
 #include "process_queries.h"
 #include "search_server.h"
 #include "log_duration.h"
 
+#include <cassert>
 #include <execution>
 #include <iostream>
 #include <random>
@@ -9,6 +11,7 @@
 #include <vector>
 
 using namespace std;
+
 /*
 void PrintDocument(const Document& document) {
     cout << "{ "s
@@ -105,6 +108,50 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     cout << total_relevance << endl;
 }
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
+
+//            -
+vector<string_view> SplitIntoWordsBaseline(string_view text, bool& has_control_characters) {
+    vector<string_view> result;
+    size_t pos = text.find_first_not_of(' ');
+    text.remove_prefix(pos == text.npos ? text.length() : pos);
+    while (!text.empty()) {
+        pos = text.find_first_of(' ');
+        result.push_back(text.substr(0, (pos == text.npos ? text.length() : pos)));
+        text.remove_prefix(pos == text.npos ? text.length() : ++pos);
+        pos = text.find_first_not_of(' ');
+        text.remove_prefix(pos == text.npos ? text.length() : pos);
+    }
+    has_control_characters = !all_of(result.begin(), result.end(), [](string_view word) {
+        return none_of(word.begin(), word.end(), [](char c) {
+            return c >= '\0' && c < ' ';
+            });
+        });
+    return result;
+}
+//         -
+template <typename Splitter>
+void TestTokenizer(string_view mark, const vector<string>& texts, Splitter split) {
+    LOG_DURATION(string{ mark });
+    size_t word_count = 0;
+    for (int repeat = 0; repeat < 10; ++repeat) {
+        for (const string& text : texts) {
+            bool has_control_characters = false;
+            word_count += split(text, has_control_characters).size() + has_control_characters;
+        }
+    }
+    cout << word_count << endl;
+}
+//         ,
+//       
+const size_t MAX_QUERY_ALLOCATIONS = 1;
+void TestQueryAllocations(string_view mark, const SearchServer& search_server, const string& query) {
+    search_server.FindTopDocuments(query);
+    const size_t before = GetAllocationCount();
+    const auto documents = search_server.FindTopDocuments(query);
+    const size_t allocations = GetAllocationCount() - before;
+    cout << mark << " query allocations: "s << allocations << endl;
+    assert(allocations <= MAX_QUERY_ALLOCATIONS);
+}
 int main() {
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -116,5 +163,13 @@ int main() {
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
     TEST(seq);
     TEST(par);
+
+    TestQueryAllocations("short"s, search_server, GenerateQuery(generator, dictionary, 3));
+    TestQueryAllocations("long"s, search_server, GenerateQuery(generator, dictionary, 500, 0.1));
+
+    TestTokenizer("tokenizer baseline"s, documents, SplitIntoWordsBaseline);
+    TestTokenizer("tokenizer simd"s, documents, [](string_view text, bool& has_control_characters) {
+        return SplitIntoWords(text, has_control_characters);
+        });
 }
 
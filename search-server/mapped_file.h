@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Файл, отображенный в память только для чтения. Страницы подгружаются ОС по мере обращения,
+// поэтому открытие большого файла не читает его целиком
+class MappedFile {
+public:
+    // Отображает файл, бросает runtime_error при ошибке
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    const uint8_t* GetData() const;
+
+    size_t GetSize() const;
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
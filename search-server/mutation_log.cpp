@@ -0,0 +1,359 @@
+#include "mutation_log.h"
+
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include "snapshot.h"
+
+using namespace std;
+
+namespace {
+
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t base_sequence; // Номер записи, после которой начинается журнал
+};
+
+struct RecordHeader {
+    uint64_t sequence;
+    uint64_t checksum; // FNV-1a 64 по данным записи и полям sequence, type, size
+    uint32_t type;
+    uint32_t size;     // Размер данных записи
+};
+
+const char LOG_MAGIC[8] = { 'S', 'R', 'C', 'H', 'L', 'O', 'G', '\0' };
+const uint32_t LOG_VERSION = 1;
+
+uint64_t ComputeRecordChecksum(const RecordHeader& header, const uint8_t* payload) {
+    uint64_t checksum = UpdateChecksum(CHECKSUM_BASIS, payload, header.size);
+    checksum = UpdateChecksum(checksum, reinterpret_cast<const uint8_t*>(&header.sequence),
+        sizeof(header.sequence));
+    checksum = UpdateChecksum(checksum, reinterpret_cast<const uint8_t*>(&header.type),
+        sizeof(header.type));
+    return UpdateChecksum(checksum, reinterpret_cast<const uint8_t*>(&header.size),
+        sizeof(header.size));
+}
+
+template <typename T>
+void AppendValue(vector<uint8_t>& data, const T& value) {
+    const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// Читает значение из данных записи, возвращает false при нехватке данных
+template <typename T>
+bool ReadValue(const uint8_t*& data, const uint8_t* end, T& value) {
+    if (static_cast<size_t>(end - data) < sizeof(T)) {
+        return false;
+    }
+    copy(data, data + sizeof(T), reinterpret_cast<uint8_t*>(&value));
+    data += sizeof(T);
+    return true;
+}
+
+// Разбирает данные записи, возвращает false, если они не соответствуют типу
+bool ParsePayload(const uint8_t* data, const uint8_t* end, Mutation& mutation) {
+    if (!ReadValue(data, end, mutation.document_id)) {
+        return false;
+    }
+    if (mutation.type == Mutation::Type::REMOVE_DOCUMENT) {
+        return data == end;
+    }
+    if (mutation.type != Mutation::Type::ADD_DOCUMENT) {
+        return false;
+    }
+
+    int32_t status = 0;
+    uint32_t rating_count = 0;
+    if (!ReadValue(data, end, status) || !ReadValue(data, end, rating_count)
+        || rating_count > static_cast<size_t>(end - data) / sizeof(int32_t)) {
+        return false;
+    }
+    mutation.status = static_cast<DocumentStatus>(status);
+    mutation.ratings.resize(rating_count);
+    for (int& rating : mutation.ratings) {
+        ReadValue(data, end, rating);
+    }
+
+    uint32_t length = 0;
+    if (!ReadValue(data, end, length) || length != static_cast<size_t>(end - data)) {
+        return false;
+    }
+    mutation.document.assign(reinterpret_cast<const char*>(data), length);
+    return true;
+}
+
+} // namespace
+
+// Открывает журнал, создавая его при отсутствии. Бросает runtime_error при ошибке,
+// invalid_argument - если файл не является журналом
+MutationLog::MutationLog(const string& path)
+    : MutationLog(path, Options{}) {
+}
+
+MutationLog::MutationLog(const string& path, Options options)
+    : path_(path)
+    , options_(options) {
+    error_code error;
+    if (!filesystem::exists(path_, error) || filesystem::file_size(path_, error) == 0) {
+        Create(0);
+    }
+    else {
+        last_sequence_ = ReadRecords([](const Mutation&) {});
+    }
+    OpenForAppend();
+
+    if (options_.sync_policy != SyncPolicy::ALWAYS) {
+        flusher_ = thread([this] { RunFlusher(); });
+    }
+}
+
+// Сбрасывает накопленные записи
+MutationLog::~MutationLog() {
+    {
+        lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    flusher_wakeup_.notify_one();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+    try {
+        Flush();
+    }
+    catch (...) {
+        // Деструктор не бросает: несохраненные записи будут потеряны как при сбое
+    }
+    fclose(file_);
+}
+
+// Добавляет запись о добавлении документа, возвращает ее номер
+uint64_t MutationLog::AppendAddDocument(int document_id, string_view document, DocumentStatus status,
+    const vector<int>& ratings) {
+    vector<uint8_t> payload;
+    payload.reserve(document.size() + ratings.size() * sizeof(int32_t) + 16);
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    AppendValue(payload, static_cast<int32_t>(status));
+    AppendValue(payload, static_cast<uint32_t>(ratings.size()));
+    for (int rating : ratings) {
+        AppendValue(payload, static_cast<int32_t>(rating));
+    }
+    AppendValue(payload, static_cast<uint32_t>(document.size()));
+    payload.insert(payload.end(), document.begin(), document.end());
+    return Append(Mutation::Type::ADD_DOCUMENT, payload);
+}
+
+// Добавляет запись об удалении документа, возвращает ее номер
+uint64_t MutationLog::AppendRemoveDocument(int document_id) {
+    vector<uint8_t> payload;
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    return Append(Mutation::Type::REMOVE_DOCUMENT, payload);
+}
+
+// Записывает накопленные записи в файл и сбрасывает на диск, если политика не NEVER.
+// Бросает ошибку прошлого фонового сброса либо ошибку записи; незаписанные записи
+// остаются в буфере и пишутся следующим сбросом
+void MutationLog::Flush() {
+    lock_guard io_lock(io_mutex_);
+    vector<uint8_t> group;
+    {
+        lock_guard lock(mutex_);
+        RethrowWriteError();
+        group.swap(buffer_);
+    }
+    if (group.empty()) {
+        return;
+    }
+
+    // Файл не буферизуется, поэтому в нем оказались ровно written байт группы. Остальные
+    // возвращаются в начало буфера, перед записями, добавленными за время записи
+    const size_t written = fwrite(group.data(), 1, group.size(), file_);
+    if (written != group.size()) {
+        clearerr(file_);
+        lock_guard lock(mutex_);
+        buffer_.insert(buffer_.begin(), group.begin() + written, group.end());
+        throw runtime_error("Cannot write "s + path_);
+    }
+    if (options_.sync_policy != SyncPolicy::NEVER) {
+        SyncFile(file_);
+    }
+}
+
+// Вызывает apply для записей с номером больше after_sequence в порядке записи.
+// Бросает invalid_argument, если журнал очищен после записи after_sequence
+void MutationLog::Replay(uint64_t after_sequence, const function<void(const Mutation&)>& apply) {
+    Flush();
+    lock_guard io_lock(io_mutex_);
+    if (base_sequence_ > after_sequence) {
+        throw invalid_argument("Mutation log starts after record "s + to_string(base_sequence_)
+            + ", records after "s + to_string(after_sequence) + " are lost"s);
+    }
+    ReadRecords([&](const Mutation& mutation) {
+        if (mutation.sequence > after_sequence) {
+            apply(mutation);
+        }
+    });
+}
+
+// Очищает журнал. Вызывается после сохранения снимка, содержащего все записи журнала;
+// нумерация записей продолжается
+void MutationLog::Truncate() {
+    Flush();
+    lock_guard io_lock(io_mutex_);
+    fclose(file_);
+    file_ = nullptr;
+    Create(GetLastSequence());
+    OpenForAppend();
+}
+
+// Возвращает номер последней записи
+uint64_t MutationLog::GetLastSequence() const {
+    lock_guard lock(mutex_);
+    return last_sequence_;
+}
+
+// Дописывает запись в буфер и при необходимости сбрасывает его, возвращает номер записи
+uint64_t MutationLog::Append(Mutation::Type type, const vector<uint8_t>& payload) {
+    uint64_t sequence = 0;
+    bool is_group_full = false;
+    {
+        lock_guard lock(mutex_);
+        RethrowWriteError();
+        sequence = ++last_sequence_;
+        RecordHeader header{ sequence, 0, static_cast<uint32_t>(type), static_cast<uint32_t>(payload.size()) };
+        header.checksum = ComputeRecordChecksum(header, payload.data());
+        AppendValue(buffer_, header);
+        buffer_.insert(buffer_.end(), payload.begin(), payload.end());
+        is_group_full = buffer_.size() >= options_.batch_size;
+    }
+
+    // Запись попадет на диск вместе со всеми, что успели накопиться к этому моменту
+    if (options_.sync_policy == SyncPolicy::ALWAYS || is_group_full) {
+        Flush();
+    }
+    return sequence;
+}
+
+// Читает журнал, отбрасывает оборванный хвост, вызывает apply для целых записей.
+// Возвращает номер последней целой записи
+uint64_t MutationLog::ReadRecords(const function<void(const Mutation&)>& apply) {
+    ifstream in(path_, ios::binary);
+    if (!in) {
+        throw runtime_error("Cannot open "s + path_);
+    }
+
+    LogHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || !equal(begin(LOG_MAGIC), end(LOG_MAGIC), header.magic)) {
+        throw invalid_argument("File is not a mutation log"s);
+    }
+    if (header.version != LOG_VERSION) {
+        throw invalid_argument("Unsupported mutation log version "s + to_string(header.version));
+    }
+    if (header.byte_order != SNAPSHOT_BYTE_ORDER_MARK) {
+        throw invalid_argument("Mutation log was written with a different byte order"s);
+    }
+
+    base_sequence_ = header.base_sequence;
+    uint64_t last_sequence = header.base_sequence;
+    uint64_t valid_size = sizeof(header);
+    vector<uint8_t> payload;
+    RecordHeader record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        payload.resize(record.size);
+        if (!in.read(reinterpret_cast<char*>(payload.data()), record.size)
+            || record.sequence != last_sequence + 1
+            || ComputeRecordChecksum(record, payload.data()) != record.checksum) {
+            break;
+        }
+
+        Mutation mutation;
+        mutation.sequence = record.sequence;
+        mutation.type = static_cast<Mutation::Type>(record.type);
+        if (!ParsePayload(payload.data(), payload.data() + payload.size(), mutation)) {
+            break;
+        }
+        apply(mutation);
+
+        last_sequence = record.sequence;
+        valid_size += sizeof(record) + record.size;
+    }
+    in.close();
+
+    // Хвост после последней целой записи оставлен прерванной записью, новые записи пойдут на его место
+    if (filesystem::file_size(path_) > valid_size) {
+        filesystem::resize_file(path_, valid_size);
+    }
+    return last_sequence;
+}
+
+// Создает журнал, начинающийся после записи base_sequence
+void MutationLog::Create(uint64_t base_sequence) {
+    LogHeader header{};
+    copy(begin(LOG_MAGIC), end(LOG_MAGIC), header.magic);
+    header.version = LOG_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER_MARK;
+    header.base_sequence = base_sequence;
+
+    // Новый журнал целиком пишется рядом и атомарно заменяет старый
+    const string temp_path = path_ + ".tmp"s;
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        throw runtime_error("Cannot create "s + temp_path);
+    }
+    const bool is_written = fwrite(&header, sizeof(header), 1, file) == 1 && fflush(file) == 0;
+    SyncFile(file);
+    fclose(file);
+    if (!is_written) {
+        throw runtime_error("Cannot write "s + temp_path);
+    }
+    filesystem::rename(temp_path, path_);
+    base_sequence_ = base_sequence;
+}
+
+// Записи и так пишутся группами, поэтому буфер stdio не нужен: без него fwrite сообщает,
+// сколько байт действительно попало в файл
+void MutationLog::OpenForAppend() {
+    file_ = fopen(path_.c_str(), "ab");
+    if (file_ == nullptr) {
+        throw runtime_error("Cannot open "s + path_);
+    }
+    setvbuf(file_, nullptr, _IONBF, 0);
+}
+
+// Бросает ошибку, сохраненную фоновым сбросом, и забывает ее. Вызывается под mutex_
+void MutationLog::RethrowWriteError() {
+    if (write_error_) {
+        rethrow_exception(exchange(write_error_, nullptr));
+    }
+}
+
+void MutationLog::RunFlusher() {
+    unique_lock lock(mutex_);
+    while (!is_stopping_) {
+        flusher_wakeup_.wait_for(lock, options_.batch_interval);
+        if (is_stopping_ || buffer_.empty()) {
+            continue;
+        }
+        lock.unlock();
+        exception_ptr error;
+        try {
+            Flush();
+        }
+        catch (...) {
+            error = current_exception();
+        }
+        lock.lock();
+
+        // Незаписанные записи вернулись в буфер, а ошибку получит следующий вызов Append или Flush
+        if (error) {
+            write_error_ = error;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+// Изменение сервера, записанное в журнал
+struct Mutation {
+    enum class Type : uint32_t {
+        ADD_DOCUMENT = 1,
+        REMOVE_DOCUMENT = 2,
+    };
+
+    uint64_t sequence = 0; // Номер записи, растет на единицу с каждой записью журнала
+    Type type = Type::ADD_DOCUMENT;
+    int document_id = 0;
+    std::string document;  // Только для ADD_DOCUMENT
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// Журнал упреждающей записи (write-ahead log) изменений сервера.
+// Файл только дописывается: заголовок с номером, после которого начинается журнал, затем записи
+// с номером, контрольной суммой и данными изменения. Записи копятся в буфере и попадают в файл
+// группами: одна запись на диск и один fsync подтверждают сразу все накопленные изменения.
+// Оборванная при сбое последняя запись отбрасывается при открытии журнала
+class MutationLog {
+public:
+    // Когда записанные в файл данные сбрасываются на диск (fsync)
+    enum class SyncPolicy {
+        ALWAYS, // При каждой записи: изменение надежно сохранено к возврату из Append
+        BATCH,  // Группами: не реже раза в batch_interval и при накоплении batch_size байт
+        NEVER,  // Сброс на диск оставлен ОС, данные пишутся в файл группами как при BATCH
+    };
+
+    struct Options {
+        SyncPolicy sync_policy = SyncPolicy::BATCH;
+        size_t batch_size = 1 << 20;
+        std::chrono::milliseconds batch_interval{ 10 };
+    };
+
+    // Открывает журнал, создавая его при отсутствии. Бросает runtime_error при ошибке,
+    // invalid_argument - если файл не является журналом
+    explicit MutationLog(const std::string& path);
+    MutationLog(const std::string& path, Options options);
+
+    MutationLog(const MutationLog&) = delete;
+    MutationLog& operator=(const MutationLog&) = delete;
+
+    // Сбрасывает накопленные записи
+    ~MutationLog();
+
+    // Добавляет запись о добавлении документа, возвращает ее номер
+    uint64_t AppendAddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+
+    // Добавляет запись об удалении документа, возвращает ее номер
+    uint64_t AppendRemoveDocument(int document_id);
+
+    // Записывает накопленные записи в файл и сбрасывает на диск, если политика не NEVER.
+    // При ошибке записи незаписанные записи остаются в буфере и пишутся следующим сбросом.
+    // Ошибку фонового сброса бросает следующий вызов Flush, AppendAddDocument или AppendRemoveDocument,
+    // и такой вызов Append* записи не добавляет
+    void Flush();
+
+    // Вызывает apply для записей с номером больше after_sequence в порядке записи.
+    // Бросает invalid_argument, если журнал очищен после записи after_sequence:
+    // часть записей, которых нет в состоянии after_sequence, уже не восстановить
+    void Replay(uint64_t after_sequence, const std::function<void(const Mutation&)>& apply);
+
+    // Очищает журнал. Вызывается после сохранения снимка, содержащего все записи журнала;
+    // нумерация записей продолжается
+    void Truncate();
+
+    // Возвращает номер последней записи
+    uint64_t GetLastSequence() const;
+
+private:
+    std::string path_;
+    Options options_;
+    std::FILE* file_ = nullptr;
+
+    // mutex_ защищает буфер и нумерацию, io_mutex_ упорядочивает запись групп в файл.
+    // Пока одна группа пишется и сбрасывается на диск, следующая копится в буфере
+    mutable std::mutex mutex_;
+    std::mutex io_mutex_;
+    std::vector<uint8_t> buffer_;  // Записи, еще не переданные в файл
+    uint64_t last_sequence_ = 0;
+    uint64_t base_sequence_ = 0;   // Номер записи, после которой начинается файл. Защищен io_mutex_
+
+    // Фоновый поток, сбрасывающий группы записей по истечении batch_interval
+    std::thread flusher_;
+    std::condition_variable flusher_wakeup_;
+    bool is_stopping_ = false;
+    std::exception_ptr write_error_; // Ошибка фонового сброса, еще не переданная вызывающему
+
+    // Дописывает запись в буфер и при необходимости сбрасывает его, возвращает номер записи
+    uint64_t Append(Mutation::Type type, const std::vector<uint8_t>& payload);
+
+    // Читает журнал, отбрасывает оборванный хвост, вызывает apply для целых записей.
+    // Возвращает номер последней целой записи
+    uint64_t ReadRecords(const std::function<void(const Mutation&)>& apply);
+
+    // Создает журнал, начинающийся после записи base_sequence
+    void Create(uint64_t base_sequence);
+
+    void OpenForAppend();
+
+    // Бросает ошибку, сохраненную фоновым сбросом, и забывает ее. Вызывается под mutex_
+    void RethrowWriteError();
+
+    void RunFlusher();
+};
@@ -0,0 +1,183 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+PostingList::Cursor::Cursor(const PostingList& list)
+    : list_(&list) {
+    LoadBlock(0);
+}
+
+// Возвращает id текущего документа либо NO_DOCUMENT
+int PostingList::Cursor::GetDocumentId() const {
+    return position_ < block_size_
+        ? document_ids_[position_]
+        : NO_DOCUMENT;
+}
+
+// Возвращает кол-во повторений слова в текущем документе
+int PostingList::Cursor::GetCount() const {
+    return counts_[position_];
+}
+
+// Переходит к следующему вхождению
+void PostingList::Cursor::Next() {
+    if (++position_ == block_size_) {
+        LoadBlock(block_ + 1);
+    }
+}
+
+// Переходит к первому вхождению с id не меньше заданного, пропуская целые блоки
+void PostingList::Cursor::Advance(int document_id) {
+    if (GetDocumentId() >= document_id) {
+        return;
+    }
+
+    AdvanceBlock(document_id);
+    if (shallow_block_ != block_) {
+        LoadBlock(shallow_block_);
+    }
+    if (position_ == block_size_) {
+        return;
+    }
+
+    // Последний id блока не меньше искомого, поэтому поиск не выходит за пределы блока
+    position_ = static_cast<size_t>(lower_bound(document_ids_ + position_,
+        document_ids_ + block_size_, document_id) - document_ids_);
+}
+
+// Переходит к блоку, где мог бы находиться документ, не распаковывая его.
+// Возвращает оценку частоты в этом блоке либо 0, если таких вхождений в списке нет
+double PostingList::Cursor::AdvanceBlock(int document_id) {
+    const BlockInfo* blocks = list_->blocks_view_;
+    const size_t block_count = list_->block_count_;
+    shallow_block_ = max(shallow_block_, block_);
+    while (shallow_block_ < block_count && blocks[shallow_block_].last_document_id < document_id) {
+        ++shallow_block_;
+    }
+    return shallow_block_ < block_count
+        ? blocks[shallow_block_].max_term_freq
+        : 0.0;
+}
+
+// Распаковывает блок и встает на его первое вхождение
+void PostingList::Cursor::LoadBlock(size_t block) {
+    block_ = block;
+    shallow_block_ = max(shallow_block_, block);
+    position_ = 0;
+    block_size_ = block < list_->block_count_
+        ? list_->DecodeBlock(block, document_ids_, counts_)
+        : 0;
+}
+
+// Дописывает вхождение документа с id больше всех имеющихся.
+// term_freq - частота слова в документе, из нее складываются оценки блоков
+void PostingList::Add(int document_id, int count, double term_freq) {
+    MakeOwned();
+    if (blocks_.empty() || blocks_.back().size == BLOCK_SIZE) {
+        blocks_.push_back({ document_id, document_id, static_cast<uint32_t>(data_.size()), 0, 0.0 });
+    }
+    else {
+        AppendVarint(data_, static_cast<uint32_t>(document_id - blocks_.back().last_document_id));
+    }
+    AppendVarint(data_, static_cast<uint32_t>(count));
+
+    BlockInfo& block = blocks_.back();
+    block.last_document_id = document_id;
+    ++block.size;
+    block.max_term_freq = max(block.max_term_freq, term_freq);
+    max_term_freq_ = max(max_term_freq_, term_freq);
+    ++size_;
+    UpdateView();
+}
+
+// Возвращает кол-во документов, содержащих слово
+size_t PostingList::Size() const {
+    return size_;
+}
+
+bool PostingList::IsEmpty() const {
+    return size_ == 0;
+}
+
+// Возвращает оценку сверху частоты слова по всем документам списка
+double PostingList::GetMaxTermFreq() const {
+    return max_term_freq_;
+}
+
+PostingList::Cursor PostingList::GetCursor() const {
+    return Cursor(*this);
+}
+
+// Записывает список в снимок
+void PostingList::Save(SnapshotWriter& writer) const {
+    writer.Write(static_cast<uint64_t>(size_));
+    writer.Write(max_term_freq_);
+    writer.Write(static_cast<uint64_t>(block_count_));
+    writer.WriteArray(blocks_view_, block_count_);
+    writer.Write(static_cast<uint64_t>(data_size_));
+    writer.WriteArray(data_view_, data_size_);
+}
+
+// Возвращает список, читающий данные из снимка без копирования.
+// Снимок должен оставаться в памяти, пока список не изменен или не уничтожен
+PostingList PostingList::Map(SnapshotReader& reader) {
+    PostingList list;
+    list.size_ = static_cast<size_t>(reader.Read<uint64_t>());
+    list.max_term_freq_ = reader.Read<double>();
+    list.block_count_ = static_cast<size_t>(reader.Read<uint64_t>());
+    list.blocks_view_ = reader.ReadArray<BlockInfo>(list.block_count_);
+    list.data_size_ = static_cast<size_t>(reader.Read<uint64_t>());
+    list.data_view_ = reader.ReadArray<uint8_t>(list.data_size_);
+    list.is_mapped_ = true;
+
+    // Блоки проверяются сразу, чтобы поврежденный снимок не приводил к чтению за границами
+    size_t size = 0;
+    for (size_t block = 0; block < list.block_count_; ++block) {
+        const BlockInfo& info = list.blocks_view_[block];
+        if (info.size == 0 || info.size > BLOCK_SIZE || info.offset > list.data_size_
+            || (block > 0 && info.offset < list.blocks_view_[block - 1].offset)) {
+            throw invalid_argument("Snapshot posting list is corrupted"s);
+        }
+        size += info.size;
+    }
+    if (size != list.size_) {
+        throw invalid_argument("Snapshot posting list is corrupted"s);
+    }
+    return list;
+}
+
+// Копирует данные снимка в собственные массивы перед изменением
+void PostingList::MakeOwned() {
+    if (is_mapped_) {
+        data_.assign(data_view_, data_view_ + data_size_);
+        blocks_.assign(blocks_view_, blocks_view_ + block_count_);
+        is_mapped_ = false;
+    }
+}
+
+// Направляет указатели для чтения на собственные массивы
+void PostingList::UpdateView() {
+    data_view_ = data_.data();
+    data_size_ = data_.size();
+    blocks_view_ = blocks_.data();
+    block_count_ = blocks_.size();
+}
+
+// Распаковывает блок, возвращает кол-во вхождений
+size_t PostingList::DecodeBlock(size_t block, int* document_ids, int* counts) const {
+    const BlockInfo& info = blocks_view_[block];
+    const uint8_t* data = data_view_ + info.offset;
+
+    int document_id = info.first_document_id;
+    for (size_t i = 0; i < info.size; ++i) {
+        if (i > 0) {
+            document_id += static_cast<int>(ReadVarint(data));
+        }
+        document_ids[i] = document_id;
+        counts[i] = static_cast<int>(ReadVarint(data));
+    }
+    return info.size;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "snapshot.h"
+#include "varint.h"
+
+// Список вхождений слова в документы, упорядоченный по id документа.
+// Вхождение - id документа и кол-во повторений слова в нем. Вхождения сжаты блоками
+// по BLOCK_SIZE: внутри блока id хранятся разностями с предыдущим, разности и кол-ва
+// записаны кодом переменной длины (varint), так что вхождение занимает обычно 2-3 байта.
+// Для каждого блока хранятся первый и последний id, смещение и верхняя оценка частоты слова -
+// по ним курсор перепрыгивает блоки, не распаковывая их, и оценивает вклад слова сверху.
+// Список, загруженный из снимка, читается прямо из отображенного файла и копируется
+// в собственную память только при первом изменении
+class PostingList {
+public:
+    static const size_t BLOCK_SIZE = 128;
+
+    // id, возвращаемый курсором после конца списка
+    static const int NO_DOCUMENT = std::numeric_limits<int>::max();
+
+    // Курсор для обхода списка документ за документом с пропуском блоков.
+    // Распаковывает за раз один блок во внутренний буфер
+    class Cursor {
+    public:
+        explicit Cursor(const PostingList& list);
+
+        // Возвращает id текущего документа либо NO_DOCUMENT
+        int GetDocumentId() const;
+
+        // Возвращает кол-во повторений слова в текущем документе
+        int GetCount() const;
+
+        // Переходит к следующему вхождению
+        void Next();
+
+        // Переходит к первому вхождению с id не меньше заданного, пропуская целые блоки
+        void Advance(int document_id);
+
+        // Переходит к блоку, где мог бы находиться документ, не распаковывая его.
+        // Возвращает оценку частоты в этом блоке либо 0, если таких вхождений в списке нет
+        double AdvanceBlock(int document_id);
+
+    private:
+        const PostingList* list_;
+        size_t block_ = 0;          // Распакованный блок
+        size_t shallow_block_ = 0;  // Блок, найденный AdvanceBlock, не левее распакованного
+        size_t position_ = 0;       // Позиция в распакованном блоке
+        size_t block_size_ = 0;
+        int document_ids_[BLOCK_SIZE];
+        int counts_[BLOCK_SIZE];
+
+        // Распаковывает блок и встает на его первое вхождение
+        void LoadBlock(size_t block);
+    };
+
+    PostingList() = default;
+
+    // Копирование запрещено: указатели для чтения ссылаются на собственные массивы
+    PostingList(const PostingList&) = delete;
+    PostingList& operator=(const PostingList&) = delete;
+
+    // При перемещении вектор сохраняет буфер, поэтому указатели остаются действительными
+    PostingList(PostingList&&) = default;
+    PostingList& operator=(PostingList&&) = default;
+
+    // Дописывает вхождение документа с id больше всех имеющихся.
+    // term_freq - частота слова в документе, из нее складываются оценки блоков
+    void Add(int document_id, int count, double term_freq);
+
+    // Возвращает кол-во документов, содержащих слово
+    size_t Size() const;
+
+    bool IsEmpty() const;
+
+    // Возвращает оценку сверху частоты слова по всем документам списка
+    double GetMaxTermFreq() const;
+
+    Cursor GetCursor() const;
+
+    // Вызывает function(id документа, кол-во) для всех вхождений по возрастанию id.
+    // Быстрее обхода курсором: блок распаковывается и проходится одним циклом
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Как ForEach, но перед распаковкой каждого блока вызывает can_continue(кол-во вхождений в блоке)
+    // и прекращает обход, если тот вернул false. Возвращает true, если пройден весь список
+    template <typename Function, typename Condition>
+    bool ForEachWhile(Function function, Condition can_continue) const;
+
+    // Записывает список в снимок
+    void Save(SnapshotWriter& writer) const;
+
+    // Возвращает список, читающий данные из снимка без копирования.
+    // Снимок должен оставаться в памяти, пока список не изменен или не уничтожен
+    static PostingList Map(SnapshotReader& reader);
+
+private:
+    struct BlockInfo {
+        int first_document_id;
+        int last_document_id;
+        uint32_t offset; // Смещение блока в data_
+        uint32_t size;   // Кол-во вхождений в блоке
+        double max_term_freq;
+    };
+
+    // Блоки подряд: кол-во первого вхождения, далее пары (разность id, кол-во)
+    std::vector<uint8_t> data_;
+    std::vector<BlockInfo> blocks_;
+
+    // Данные для чтения: указывают на data_ и blocks_ либо в отображенный снимок
+    const uint8_t* data_view_ = nullptr;
+    size_t data_size_ = 0;
+    const BlockInfo* blocks_view_ = nullptr;
+    size_t block_count_ = 0;
+    bool is_mapped_ = false;
+
+    size_t size_ = 0;
+    double max_term_freq_ = 0.0;
+
+    // Копирует данные снимка в собственные массивы перед изменением
+    void MakeOwned();
+
+    // Направляет указатели для чтения на собственные массивы
+    void UpdateView();
+
+    // Распаковывает блок, возвращает кол-во вхождений
+    size_t DecodeBlock(size_t block, int* document_ids, int* counts) const;
+};
+
+// Вызывает function(id документа, кол-во) для всех вхождений по возрастанию id.
+// Быстрее обхода курсором: блок распаковывается и проходится одним циклом
+template <typename Function>
+void PostingList::ForEach(Function function) const {
+    int document_ids[BLOCK_SIZE];
+    int counts[BLOCK_SIZE];
+    for (size_t block = 0; block < block_count_; ++block) {
+        const size_t block_size = DecodeBlock(block, document_ids, counts);
+        for (size_t i = 0; i < block_size; ++i) {
+            function(document_ids[i], counts[i]);
+        }
+    }
+}
+
+// Как ForEach, но перед распаковкой каждого блока вызывает can_continue(кол-во вхождений в блоке)
+// и прекращает обход, если тот вернул false. Возвращает true, если пройден весь список
+template <typename Function, typename Condition>
+bool PostingList::ForEachWhile(Function function, Condition can_continue) const {
+    int document_ids[BLOCK_SIZE];
+    int counts[BLOCK_SIZE];
+    for (size_t block = 0; block < block_count_; ++block) {
+        if (!can_continue(blocks_view_[block].size)) {
+            return false;
+        }
+        const size_t block_size = DecodeBlock(block, document_ids, counts);
+        for (size_t i = 0; i < block_size; ++i) {
+            function(document_ids[i], counts[i]);
+        }
+    }
+    return true;
+}
@@ -1,31 +1,190 @@
 #include "process_queries.h"
 
 #include <algorithm>
-#include <execution>
+#include <stdexcept>
+#include <utility>
 
-//    ,  
+namespace {
+
+//        
+QueryExecutor& GetDefaultQueryExecutor() {
+    static QueryExecutor executor;
+    return executor;
+}
+
+//  ,     MAX_RESULT_DOCUMENT_COUNT ,  
+// . offsets[i + 1]   -    i,   -   
+void CompactJoinedDocuments(std::vector<Document>& documents, std::vector<size_t>& offsets) {
+    const size_t query_count = offsets.size() - 1;
+    for (size_t index = 0; index < query_count; ++index) {
+        const auto slot = documents.begin() + index * MAX_RESULT_DOCUMENT_COUNT;
+        const size_t count = offsets[index + 1];
+        //    ,      
+        if (offsets[index] != index * MAX_RESULT_DOCUMENT_COUNT) {
+            std::copy(slot, slot + count, documents.begin() + offsets[index]);
+        }
+        offsets[index + 1] = offsets[index] + count;
+    }
+    documents.resize(offsets.back());
+}
+
+} // namespace
+
+//    ,     
 std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    return ProcessQueries(GetDefaultQueryExecutor(), search_server, queries);
+}
+
+//      executor.        ,
+//       ,    
+std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
     std::vector<std::vector<Document>> result(queries.size());
 
-    std::transform(std::execution::par,
-        queries.begin(), queries.end(),
-        result.begin(), [&search_server](const std::string& query) {
-            return search_server.FindTopDocuments(query);
+    executor.ForEach(queries.size(), [&](size_t index) {
+        result[index] = search_server.FindTopDocuments(queries[index]);
         });
 
     return result;
 }
 
-std::list<Document> ProcessQueriesJoined(
+// offsets - query_count + 1  ,   documents.size().
+// is_partial -     ,   ,    
+JoinedResults::JoinedResults(std::vector<Document> documents, std::vector<size_t> offsets,
+    std::vector<char> is_partial)
+    : documents_(std::move(documents))
+    , offsets_(std::move(offsets))
+    , is_partial_(std::move(is_partial)) {
+}
+
+JoinedResults::const_iterator JoinedResults::begin() const {
+    return documents_.begin();
+}
+
+JoinedResults::const_iterator JoinedResults::end() const {
+    return documents_.end();
+}
+
+//  -   
+size_t JoinedResults::size() const {
+    return documents_.size();
+}
+
+bool JoinedResults::empty() const {
+    return documents_.empty();
+}
+
+//  -  
+size_t JoinedResults::GetQueryCount() const {
+    return offsets_.size() - 1;
+}
+
+//   ,  out_of_range    
+IteratorRange<JoinedResults::const_iterator> JoinedResults::GetQueryDocuments(size_t query_index) const {
+    if (query_index >= GetQueryCount()) {
+        throw std::out_of_range("Query index is out of range");
+    }
+    return { documents_.begin() + offsets_[query_index], documents_.begin() + offsets_[query_index + 1] };
+}
+
+//  true,      ,
+//  out_of_range    
+bool JoinedResults::IsPartial(size_t query_index) const {
+    if (query_index >= GetQueryCount()) {
+        throw std::out_of_range("Query index is out of range");
+    }
+    return !is_partial_.empty() && is_partial_[query_index];
+}
+
+//     
+const std::vector<size_t>& JoinedResults::GetOffsets() const {
+    return offsets_;
+}
+
+//           
+JoinedResults ProcessQueriesJoined(
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
-    std::list<Document> result;
+    return ProcessQueriesJoined(GetDefaultQueryExecutor(), search_server, queries);
+}
 
-    for (const auto& doc : ProcessQueries(search_server, queries)) {
-        result.insert(result.end(), doc.begin(), doc.end());
-    }
+//     MAX_RESULT_DOCUMENT_COUNT,    
+//   :      ,    
+//            
+JoinedResults ProcessQueriesJoined(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    std::vector<Document> documents(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+    std::vector<size_t> offsets(queries.size() + 1, 0);
+
+    executor.ForEach(queries.size(), [&](size_t index) {
+        const auto query_documents = search_server.FindTopDocuments(queries[index]);
+        std::copy(query_documents.begin(), query_documents.end(),
+            documents.begin() + index * MAX_RESULT_DOCUMENT_COUNT);
+        offsets[index + 1] = query_documents.size();
+        });
+    CompactJoinedDocuments(documents, offsets);
+
+    return JoinedResults(std::move(documents), std::move(offsets));
+}
+
+//       ,     
+std::vector<SearchResult> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget) {
+    return ProcessQueries(GetDefaultQueryExecutor(), search_server, queries, budget);
+}
+
+//      executor.     ,
+//       ,  search_timeout 
+//   ,   
+std::vector<SearchResult> ProcessQueries(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget) {
+    std::vector<SearchResult> result(queries.size());
+
+    executor.ForEach(queries.size(), [&](size_t index) {
+        result[index] = search_server.FindTopDocuments(queries[index], budget);
+        });
 
     return result;
 }
+
+//              
+JoinedResults ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget) {
+    return ProcessQueriesJoined(GetDefaultQueryExecutor(), search_server, queries, budget);
+}
+
+//  ,  ProcessQueriesJoined  ,     
+//       
+JoinedResults ProcessQueriesJoined(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget) {
+    std::vector<Document> documents(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+    std::vector<size_t> offsets(queries.size() + 1, 0);
+    std::vector<char> is_partial(queries.size(), 0);
+
+    executor.ForEach(queries.size(), [&](size_t index) {
+        const SearchResult query_result = search_server.FindTopDocuments(queries[index], budget);
+        std::copy(query_result.documents.begin(), query_result.documents.end(),
+            documents.begin() + index * MAX_RESULT_DOCUMENT_COUNT);
+        offsets[index + 1] = query_result.documents.size();
+        is_partial[index] = query_result.is_partial;
+        });
+    CompactJoinedDocuments(documents, offsets);
+
+    return JoinedResults(std::move(documents), std::move(offsets), std::move(is_partial));
+}
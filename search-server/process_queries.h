@@ -1,14 +1,99 @@
 #pragma once
 
 #include "document.h"
+#include "paginator.h"
+#include "query_executor.h"
 #include "search_server.h"
-#include <list>
 #include <vector>
 
+// Выдачи пакета запросов в одном непрерывном буфере. Смещения хранятся в формате CSR:
+// выдача запроса i занимает документы [offsets[i], offsets[i + 1]). Обход диапазоном
+// дает все документы по порядку запросов
+class JoinedResults {
+public:
+    using const_iterator = std::vector<Document>::const_iterator;
+
+    // offsets - query_count + 1 неубывающих смещений, последнее равно documents.size().
+    // is_partial - признаки неполных выдач по запросам, пустой вектор означает, что все выдачи полные
+    JoinedResults(std::vector<Document> documents, std::vector<size_t> offsets,
+        std::vector<char> is_partial = {});
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    // Возвращает кол-во документов всех выдач
+    size_t size() const;
+
+    bool empty() const;
+
+    // Возвращает кол-во запросов пакета
+    size_t GetQueryCount() const;
+
+    // Возвращает выдачу запроса, бросает out_of_range для номера вне пакета
+    IteratorRange<const_iterator> GetQueryDocuments(size_t query_index) const;
+
+    // Возвращает true, если поиск запроса прерван исчерпанием бюджета,
+    // бросает out_of_range для номера вне пакета
+    bool IsPartial(size_t query_index) const;
+
+    // Возвращает смещения выдач в буфере
+    const std::vector<size_t>& GetOffsets() const;
+
+private:
+    std::vector<Document> documents_;
+    std::vector<size_t> offsets_;
+    std::vector<char> is_partial_;
+};
+
+// Выполняет запросы в общем пуле потоков по числу ядер, выдачи идут в порядке запросов
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// Выполняет запросы в потоках executor, выдачи идут в порядке запросов
 std::vector<std::vector<Document>> ProcessQueries(
+    QueryExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
-std::list<Document> ProcessQueriesJoined(
+// Выполняет запросы в общем пуле потоков, выдачи всех запросов записываются подряд
+JoinedResults ProcessQueriesJoined(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
+
+// Выполняет запросы в потоках executor, выдачи всех запросов записываются подряд
+JoinedResults ProcessQueriesJoined(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// Выполняет запросы в общем пуле потоков, каждый запрос в пределах бюджета budget.
+// Вхождения и search_timeout бюджета отсчитываются для каждого запроса отдельно от его начала,
+// а deadline - общий срок всего пакета. Выдачи идут в порядке запросов
+std::vector<SearchResult> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget);
+
+// Выполняет запросы в потоках executor, каждый запрос в пределах бюджета budget
+std::vector<SearchResult> ProcessQueries(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget);
+
+// Выполняет запросы в общем пуле потоков, каждый запрос в пределах бюджета budget,
+// выдачи всех запросов записываются подряд
+JoinedResults ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget);
+
+// Выполняет запросы в потоках executor, каждый запрос в пределах бюджета budget,
+// выдачи всех запросов записываются подряд
+JoinedResults ProcessQueriesJoined(
+    QueryExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    const SearchBudget& budget);
@@ -0,0 +1,96 @@
+#include "query_cache.h"
+
+#include <functional>
+
+using namespace std;
+
+namespace {
+
+// Добавляет хэш значения к накопленному
+void CombineHash(size_t& hash, size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+}
+
+} // namespace
+
+bool QueryCache::Key::operator==(const Key& other) const {
+    return plus_terms == other.plus_terms && minus_terms == other.minus_terms
+        && status == other.status && predicate_key == other.predicate_key
+        && is_parallel == other.is_parallel && max_count == other.max_count;
+}
+
+size_t QueryCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = key.plus_terms.size();
+    for (int term_id : key.plus_terms) {
+        CombineHash(hash, static_cast<size_t>(term_id));
+    }
+    // Граница плюс- и минус-слов входит в хэш через размер второго списка
+    CombineHash(hash, key.minus_terms.size());
+    for (int term_id : key.minus_terms) {
+        CombineHash(hash, static_cast<size_t>(term_id));
+    }
+    CombineHash(hash, static_cast<size_t>(key.status));
+    CombineHash(hash, std::hash<string>{}(key.predicate_key));
+    CombineHash(hash, key.is_parallel);
+    CombineHash(hash, key.max_count);
+    return hash;
+}
+
+// capacity - наибольшее кол-во хранимых выдач
+QueryCache::QueryCache(size_t capacity)
+    : capacity_(capacity) {
+}
+
+// Возвращает сохраненную выдачу поколения generation либо nullopt
+optional<vector<Document>> QueryCache::Find(const Key& key, uint64_t generation) {
+    lock_guard guard(mutex_);
+    Synchronize(generation);
+
+    const auto it = entry_by_key_.find(key);
+    if (it == entry_by_key_.end()) {
+        ++statistics_.miss_count;
+        return nullopt;
+    }
+    ++statistics_.hit_count;
+
+    // Запрошенная запись переносится в начало очереди вытеснения
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+}
+
+// Сохраняет выдачу, вытесняя самую давно запрошенную при заполнении кэша
+void QueryCache::Insert(Key key, uint64_t generation, vector<Document> documents) {
+    lock_guard guard(mutex_);
+    Synchronize(generation);
+    if (capacity_ == 0 || generation != generation_) {
+        return;
+    }
+
+    // Та же выдача могла быть сохранена другим потоком, пока этот ее считал
+    if (const auto it = entry_by_key_.find(key); it != entry_by_key_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+
+    if (entries_.size() == capacity_) {
+        entry_by_key_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+    entries_.emplace_front(move(key), move(documents));
+    entry_by_key_.emplace(entries_.front().first, entries_.begin());
+}
+
+QueryCache::Statistics QueryCache::GetStatistics() const {
+    lock_guard guard(mutex_);
+    return statistics_;
+}
+
+// Очищает кэш, если записи принадлежат другому поколению. Выдача устаревшего поколения,
+// досчитанная после изменения индекса, в кэш не попадает
+void QueryCache::Synchronize(uint64_t generation) {
+    if (generation > generation_) {
+        entries_.clear();
+        entry_by_key_.clear();
+        generation_ = generation;
+    }
+}
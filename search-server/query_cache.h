@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+// Кэш результатов поиска с вытеснением давно не запрошенных (LRU).
+// Ключ - разобранный запрос, поэтому запросы, отличающиеся порядком и повторами слов,
+// делят одну запись. Записи действительны для одного поколения индекса: любое изменение
+// сервера увеличивает поколение, и при первом обращении с новым поколением кэш очищается.
+// Методы потокобезопасны
+class QueryCache {
+public:
+    struct Key {
+        std::vector<int> plus_terms;  // id плюс-слов по возрастанию без повторов
+        std::vector<int> minus_terms; // id минус-слов по возрастанию без повторов
+        int status = -1;              // Статус документов либо -1 для предиката с ключом
+        std::string predicate_key;    // Ключ предиката, заданный вызывающим
+        bool is_parallel = false;
+        size_t max_count = 0;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct Statistics {
+        uint64_t hit_count = 0;
+        uint64_t miss_count = 0;
+    };
+
+    // capacity - наибольшее кол-во хранимых выдач
+    explicit QueryCache(size_t capacity);
+
+    // Возвращает сохраненную выдачу поколения generation либо nullopt
+    std::optional<std::vector<Document>> Find(const Key& key, uint64_t generation);
+
+    // Сохраняет выдачу, вытесняя самую давно запрошенную при заполнении кэша
+    void Insert(Key key, uint64_t generation, std::vector<Document> documents);
+
+    Statistics GetStatistics() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    using Entry = std::pair<Key, std::vector<Document>>;
+
+    size_t capacity_;
+
+    mutable std::mutex mutex_;
+    uint64_t generation_ = 0;
+
+    // Записи от последней запрошенной к самой давней
+    std::list<Entry> entries_;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entry_by_key_;
+    Statistics statistics_;
+
+    // Очищает кэш, если записи принадлежат другому поколению
+    void Synchronize(uint64_t generation);
+};
+
+// Предикат поиска с ключом, под которым его выдачи сохраняются в кэше запросов.
+// Одинаковый ключ должен означать одинаковый отбор документов
+template <typename DocumentPredicate>
+struct CachedPredicate {
+    std::string cache_key;
+    DocumentPredicate predicate;
+};
+
+// Создает предикат с ключом кэша
+template <typename DocumentPredicate>
+CachedPredicate<DocumentPredicate> MakeCachedPredicate(std::string_view cache_key,
+    DocumentPredicate predicate) {
+    return { std::string(cache_key), std::move(predicate) };
+}
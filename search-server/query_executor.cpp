@@ -0,0 +1,190 @@
+#include "query_executor.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+size_t ResolveThreadCount(size_t thread_count) {
+    if (thread_count > 0) {
+        return thread_count;
+    }
+    return max<size_t>(thread::hardware_concurrency(), 1);
+}
+
+} // namespace
+
+// Задачи делятся на непрерывные диапазоны по числу потоков
+QueryExecutor::Batch::Batch(size_t count, const function<void(size_t)>& task, size_t worker_count)
+    : task(task)
+    , queues(worker_count)
+    , unfinished_count(count) {
+    for (size_t worker = 0; worker < worker_count; ++worker) {
+        queues[worker].begin = count * worker / worker_count;
+        queues[worker].end = count * (worker + 1) / worker_count;
+    }
+}
+
+// thread_count - кол-во рабочих потоков, 0 - по числу ядер
+QueryExecutor::QueryExecutor(size_t thread_count) {
+    const size_t worker_count = ResolveThreadCount(thread_count);
+    threads_.reserve(worker_count);
+    for (size_t worker = 0; worker < worker_count; ++worker) {
+        threads_.emplace_back([this, worker] {
+            RunWorker(worker);
+        });
+    }
+}
+
+// Дожидается выполнения принятых пакетов и останавливает потоки. Потоки завершаются,
+// только когда задачи всех пакетов разобраны, а взятые задачи они дорабатывают до конца
+QueryExecutor::~QueryExecutor() {
+    {
+        lock_guard guard(mutex_);
+        is_stopping_ = true;
+    }
+    batch_added_.notify_all();
+    for (thread& worker_thread : threads_) {
+        worker_thread.join();
+    }
+}
+
+size_t QueryExecutor::GetThreadCount() const {
+    return threads_.size();
+}
+
+// Вызывает task(index) для каждого index из [0, count) в рабочих потоках
+void QueryExecutor::ForEach(size_t count, const function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+    const auto batch = make_shared<Batch>(count, task, threads_.size());
+    {
+        lock_guard guard(mutex_);
+        batches_.push_back(batch);
+        batch_count_ = batches_.size();
+    }
+    batch_added_.notify_all();
+
+    {
+        unique_lock lock(mutex_);
+        batch_finished_.wait(lock, [&batch] {
+            return batch->is_finished;
+        });
+    }
+
+    if (batch->error) {
+        rethrow_exception(batch->error);
+    }
+}
+
+// Поток берет пакет из списка по кругу, начиная со своего номера, так что одновременные пакеты
+// получают потоки поровну. Пока пакет единственный, поток разбирает его без блокировки пула,
+// а при нескольких пакетах после каждой задачи переходит к следующему
+void QueryExecutor::RunWorker(size_t worker) {
+    size_t turn = worker;
+    while (true) {
+        shared_ptr<Batch> batch;
+        {
+            unique_lock lock(mutex_);
+            batch_added_.wait(lock, [this] {
+                return is_stopping_ || !batches_.empty();
+            });
+            if (batches_.empty()) {
+                return;
+            }
+            batch = batches_[turn++ % batches_.size()];
+        }
+
+        size_t index = 0;
+        bool has_task = false;
+        do {
+            has_task = PopTask(*batch, worker, index) || StealTask(*batch, worker, index);
+            if (has_task) {
+                RunTask(*batch, index);
+            }
+        } while (has_task && batch_count_ == 1);
+
+        if (!has_task) {
+            RetireBatch(batch);
+        }
+    }
+}
+
+// Выполняет задачу index пакета и отмечает ее выполненной. Последняя выполненная задача
+// будит вызвавшего ForEach
+void QueryExecutor::RunTask(Batch& batch, size_t index) {
+    // После ошибки оставшиеся задачи только разбираются из очередей
+    if (!batch.is_failed) {
+        try {
+            batch.task(index);
+        }
+        catch (...) {
+            lock_guard guard(mutex_);
+            if (!batch.error) {
+                batch.error = current_exception();
+            }
+            batch.is_failed = true;
+        }
+    }
+
+    if (batch.unfinished_count.fetch_sub(1) == 1) {
+        {
+            lock_guard guard(mutex_);
+            batch.is_finished = true;
+        }
+        batch_finished_.notify_all();
+    }
+}
+
+// Убирает пакет, все задачи которого взяты, из списка пакетов с работой.
+// Пакет может быть уже убран другим потоком
+void QueryExecutor::RetireBatch(const shared_ptr<Batch>& batch) {
+    lock_guard guard(mutex_);
+    const auto position = find(batches_.begin(), batches_.end(), batch);
+    if (position != batches_.end()) {
+        batches_.erase(position);
+        batch_count_ = batches_.size();
+    }
+}
+
+// Берет следующую задачу своего диапазона
+bool QueryExecutor::PopTask(Batch& batch, size_t worker, size_t& index) {
+    WorkerQueue& queue = batch.queues[worker];
+    lock_guard guard(queue.mutex);
+    if (queue.begin == queue.end) {
+        return false;
+    }
+    index = queue.begin++;
+    return true;
+}
+
+// Забирает половину задач другого потока. Поток, у которого забирают, продолжает с начала
+// диапазона, а забранная вторая половина сама может быть перехвачена дальше
+bool QueryExecutor::StealTask(Batch& batch, size_t worker, size_t& index) {
+    const size_t worker_count = batch.queues.size();
+    for (size_t offset = 1; offset < worker_count; ++offset) {
+        WorkerQueue& victim = batch.queues[(worker + offset) % worker_count];
+        size_t begin = 0;
+        size_t end = 0;
+        {
+            lock_guard guard(victim.mutex);
+            if (victim.begin == victim.end) {
+                continue;
+            }
+            begin = victim.begin + (victim.end - victim.begin) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        index = begin;
+        WorkerQueue& queue = batch.queues[worker];
+        lock_guard guard(queue.mutex);
+        queue.begin = begin + 1;
+        queue.end = end;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков для пакетной обработки запросов с перехватом работы (work stealing).
+// Пакет из count задач делится на непрерывные диапазоны по числу потоков. Поток берет задачи
+// из начала своего диапазона, а опустошив его, забирает вторую половину оставшихся задач
+// у другого потока, поэтому дешевые и дорогие запросы одного пакета распределяются между
+// потоками сами. Пакеты, переданные из разных потоков, выполняются одновременно: пока пакетов
+// несколько, поток после каждой задачи переходит к следующему пакету по кругу.
+// Потоки живут, пока жив пул, и сохраняют свою рабочую память поиска между запросами и пакетами
+class QueryExecutor {
+public:
+    // thread_count - кол-во рабочих потоков, 0 - по числу ядер
+    explicit QueryExecutor(size_t thread_count = 0);
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    // Дожидается выполнения принятых пакетов и останавливает потоки
+    ~QueryExecutor();
+
+    size_t GetThreadCount() const;
+
+    // Вызывает task(index) для каждого index из [0, count) в рабочих потоках и возвращается,
+    // когда все задачи выполнены. Если задача бросила исключение, оставшиеся задачи пропускаются,
+    // а первое исключение пробрасывается вызывающему. Пакеты из разных потоков выполняются
+    // одновременно; вызывать ForEach из задачи нельзя
+    void ForEach(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    // Невыполненные задачи потока [begin, end)
+    struct WorkerQueue {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    // Пакет задач. Живет, пока его не покинут вызвавший ForEach и все потоки, бравшие из него задачи
+    struct Batch {
+        Batch(size_t count, const std::function<void(size_t)>& task, size_t worker_count);
+
+        const std::function<void(size_t)>& task;
+        std::vector<WorkerQueue> queues;          // Диапазоны задач пакета по потокам
+        std::atomic<size_t> unfinished_count;     // Задачи, еще не выполненные до конца
+        std::atomic<bool> is_failed = false;
+        std::exception_ptr error;                 // Защищен mutex_ пула
+        bool is_finished = false;                 // Защищен mutex_ пула
+    };
+
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable batch_added_;
+    std::condition_variable batch_finished_;
+    // Пакеты, в которых остались не взятые задачи, в порядке поступления
+    std::vector<std::shared_ptr<Batch>> batches_;
+    std::atomic<size_t> batch_count_ = 0;     // batches_.size() для чтения без блокировки
+    bool is_stopping_ = false;
+
+    void RunWorker(size_t worker);
+
+    // Выполняет задачу index пакета и отмечает ее выполненной
+    void RunTask(Batch& batch, size_t index);
+
+    // Убирает пакет, все задачи которого взяты, из списка пакетов с работой
+    void RetireBatch(const std::shared_ptr<Batch>& batch);
+
+    // Берет следующую задачу своего диапазона
+    static bool PopTask(Batch& batch, size_t worker, size_t& index);
+
+    // Забирает половину задач другого потока: первую из них возвращает, остальные
+    // переносит в свой диапазон. Возвращает false, если задач не осталось
+    static bool StealTask(Batch& batch, size_t worker, size_t& index);
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cmath>
+#include <stdexcept>
+#include <variant>
+
+// Статистика индекса на момент запроса, по которой модели ранжирования считают оценки
+struct CorpusStatistics {
+    int document_count = 0;
+    double average_document_length = 0.0; // Среднее кол-во слов документа без стоп-слов
+
+    // Индекс - внутренний id документа
+    const int* document_lengths = nullptr;        // Кол-во слов документа без стоп-слов
+    const double* inv_document_lengths = nullptr; // 1 / кол-во слов документа
+};
+
+// Модели ранжирования. Релевантность документа - сумма по плюс-словам запроса произведений
+// веса слова на оценку его вхождения в документ. Модель готовит к запросу Ranker, методы которого
+// вызываются во внутренних циклах поиска: циклы компилируются для каждой модели отдельно,
+// и оценка вхождения встраивается в них.
+// ComputeMaxTermScore ограничивает оценку вхождения сверху по частоте слова в документе
+// (кол-во повторений / кол-во слов), максимумы которой по блокам хранят списки вхождений
+
+// TF-IDF: вес слова - log(кол-во документов / кол-во документов со словом),
+// оценка вхождения - частота слова в документе
+class TfIdfScorer {
+public:
+    class Ranker {
+    public:
+        Ranker() = default;
+
+        explicit Ranker(const CorpusStatistics& statistics)
+            : document_count_(statistics.document_count)
+            , inv_document_lengths_(statistics.inv_document_lengths) {
+        }
+
+        double ComputeTermWeight(int term_document_count) const {
+            return std::log(document_count_ * 1.0 / term_document_count);
+        }
+
+        double ComputeTermScore(int internal_id, int count) const {
+            return count * inv_document_lengths_[internal_id];
+        }
+
+        double ComputeMaxTermScore(double max_term_freq) const {
+            return max_term_freq;
+        }
+
+    private:
+        int document_count_ = 0;
+        const double* inv_document_lengths_ = nullptr;
+    };
+
+    Ranker Prepare(const CorpusStatistics& statistics) const {
+        return Ranker(statistics);
+    }
+};
+
+// Okapi BM25: вес слова - log(1 + (N - df + 0.5) / (df + 0.5)), где N - кол-во документов,
+// df - кол-во документов со словом. Оценка вхождения
+// count * (k1 + 1) / (count + k1 * (1 - b + b * длина документа / средняя длина)):
+// k1 ограничивает вклад повторений слова, b задает долю нормировки по длине документа
+class Bm25Scorer {
+public:
+    class Ranker {
+    public:
+        Ranker() = default;
+
+        Ranker(const CorpusStatistics& statistics, double k1, double b)
+            : document_count_(statistics.document_count)
+            , document_lengths_(statistics.document_lengths)
+            , k1_plus_one_(k1 + 1.0)
+            , length_offset_(k1 * (1.0 - b))
+            , length_factor_(statistics.average_document_length > 0.0
+                ? k1 * b / statistics.average_document_length : 0.0) {
+        }
+
+        double ComputeTermWeight(int term_document_count) const {
+            return std::log(1.0 + (document_count_ - term_document_count + 0.5) / (term_document_count + 0.5));
+        }
+
+        double ComputeTermScore(int internal_id, int count) const {
+            return count * k1_plus_one_ / (count + length_offset_ + length_factor_ * document_lengths_[internal_id]);
+        }
+
+        // Деление числителя и знаменателя оценки на длину документа и отбрасывание
+        // неотрицательного слагаемого k1 * (1 - b) / длина дает оценку, растущую с частотой
+        double ComputeMaxTermScore(double max_term_freq) const {
+            if (max_term_freq <= 0.0) {
+                return 0.0;
+            }
+            return max_term_freq * k1_plus_one_ / (max_term_freq + length_factor_);
+        }
+
+    private:
+        int document_count_ = 0;
+        const int* document_lengths_ = nullptr;
+        double k1_plus_one_ = 0.0;
+        double length_offset_ = 0.0;
+        double length_factor_ = 0.0;
+    };
+
+    // Бросает invalid_argument, если k1 < 0 или b вне [0, 1]
+    explicit Bm25Scorer(double k1 = 1.2, double b = 0.75)
+        : k1_(k1)
+        , b_(b) {
+        if (!(k1 >= 0.0) || !(b >= 0.0 && b <= 1.0)) {
+            throw std::invalid_argument("Invalid BM25 parameters");
+        }
+    }
+
+    Ranker Prepare(const CorpusStatistics& statistics) const {
+        return Ranker(statistics, k1_, b_);
+    }
+
+private:
+    double k1_;
+    double b_;
+};
+
+// Модель ранжирования сервера
+using ScoringModel = std::variant<TfIdfScorer, Bm25Scorer>;
+
+// Модель ранжирования, подготовленная к запросу
+using ScoringRanker = std::variant<TfIdfScorer::Ranker, Bm25Scorer::Ranker>;
@@ -0,0 +1,55 @@
+#include "search_budget.h"
+
+using namespace std;
+
+// Возвращает бюджет, истекающий через timeout от текущего момента
+SearchBudget SearchBudget::WithTimeout(Clock::duration timeout) {
+    SearchBudget budget;
+    budget.deadline = Clock::now() + timeout;
+    return budget;
+}
+
+// Возвращает бюджет, дающий каждому поиску timeout от его начала
+SearchBudget SearchBudget::WithSearchTimeout(Clock::duration timeout) {
+    SearchBudget budget;
+    budget.search_timeout = timeout;
+    return budget;
+}
+
+// Срок поиска - раннее из deadline и search_timeout от момента создания
+BudgetMeter::BudgetMeter(const SearchBudget& budget)
+    : budget_(budget) {
+    if (budget_.search_timeout != SearchBudget::Clock::duration::max()) {
+        const auto now = SearchBudget::Clock::now();
+        // Сравнение до сложения не дает сроку переполниться при большом search_timeout
+        if (budget_.search_timeout < budget_.deadline - now) {
+            budget_.deadline = now + budget_.search_timeout;
+        }
+    }
+}
+
+// Списывает posting_count вхождений. Время проверяется, когда сумма списанного
+// переходит через границу CLOCK_CHECK_INTERVAL, поэтому первое списание всегда проверяет его
+bool BudgetMeter::Spend(uint64_t posting_count) {
+    if (is_exhausted_.load(memory_order_relaxed)) {
+        return false;
+    }
+    const uint64_t spent_before = spent_postings_.fetch_add(posting_count, memory_order_relaxed);
+    const uint64_t spent_after = spent_before + posting_count;
+
+    bool is_exhausted = spent_after > budget_.max_postings;
+    if (!is_exhausted && (spent_before == 0
+        || spent_before / CLOCK_CHECK_INTERVAL != spent_after / CLOCK_CHECK_INTERVAL)) {
+        is_exhausted = SearchBudget::Clock::now() >= budget_.deadline;
+    }
+    if (is_exhausted) {
+        is_exhausted_.store(true, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// Возвращает true, если хотя бы одно списание не удалось
+bool BudgetMeter::IsExhausted() const {
+    return is_exhausted_.load(memory_order_relaxed);
+}
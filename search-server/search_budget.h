@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "document.h"
+
+// Ограничение поиска по времени и по объему работы. Объем - кол-во обработанных вхождений
+// слов в документы. По умолчанию поиск не ограничен
+struct SearchBudget {
+    using Clock = std::chrono::steady_clock;
+
+    // Общий срок: поиск, начатый позже, сразу возвращает неполную выдачу
+    Clock::time_point deadline = Clock::time_point::max();
+    // Время одного поиска, отсчитывается от его начала
+    Clock::duration search_timeout = Clock::duration::max();
+    uint64_t max_postings = std::numeric_limits<uint64_t>::max();
+
+    // Возвращает бюджет, истекающий через timeout от текущего момента
+    static SearchBudget WithTimeout(Clock::duration timeout);
+
+    // Возвращает бюджет, дающий каждому поиску timeout от его начала
+    static SearchBudget WithSearchTimeout(Clock::duration timeout);
+};
+
+// Выдача поиска с ограничением. is_partial - бюджет исчерпан до конца поиска, и выдача составлена
+// из лучших документов, найденных к этому моменту, по накопленной релевантности
+struct SearchResult {
+    std::vector<Document> documents;
+    bool is_partial = false;
+};
+
+// Расход бюджета одного поиска. Поиск списывает вхождения перед обработкой каждого блока
+// списка и прекращается, как только списание не удалось. Время проверяется не при каждом
+// списании, а раз в CLOCK_CHECK_INTERVAL вхождений. Методы потокобезопасны
+class BudgetMeter {
+public:
+    static const uint64_t CLOCK_CHECK_INTERVAL = 1024;
+
+    // Срок поиска - раннее из deadline и search_timeout от момента создания
+    explicit BudgetMeter(const SearchBudget& budget);
+
+    // Списывает posting_count вхождений. Возвращает false, если бюджет исчерпан
+    // и вхождения обрабатывать не следует
+    bool Spend(uint64_t posting_count);
+
+    // Возвращает true, если хотя бы одно списание не удалось
+    bool IsExhausted() const;
+
+private:
+    SearchBudget budget_;
+    std::atomic<uint64_t> spent_postings_ = 0;
+    std::atomic<bool> is_exhausted_ = false;
+};
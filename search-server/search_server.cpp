@@ -1,47 +1,93 @@
 #include "search_server.h"
 
+#include <atomic>
 #include <iterator>
+#include <set>
 
 using namespace std;
 
 // Конструктор преобразует строку string_view в контейнер и вызывает шаблонный контруктор
 SearchServer::SearchServer(string_view stop_words_text)
     : SearchServer(
-        SplitIntoWords(stop_words_text))  // Вызов шаблонного контруктора с контейнером
+        MakeUniqueNonEmptyStrings(stop_words_text))  // Вызов шаблонного контруктора с контейнером
 {}
 
 // Конструктор преобразует строку const std::string& в контейнер и вызывает шаблонный контруктор
 SearchServer::SearchServer(const string& stop_words_text)
-    : SearchServer(
-        SplitIntoWords(stop_words_text))  // Вызов шаблонного контруктора с контейнером
+    : SearchServer(string_view{ stop_words_text })
 {}
 
 // Добавление документа на сервер
 void SearchServer::AddDocument(int document_id, string_view document, DocumentStatus status,
     const vector<int>& ratings) {
-    document_.push_back(string{ document });
-
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    if ((document_id < 0) || (document_ids_.count(document_id) > 0)) {
         throw invalid_argument("Invalid document_id"s);
     }
-    const auto words = SplitIntoWordsNoStop(document_.back());
+    PollMerge();
+    // Слова проверяются до изменения словаря, чтобы неудачное добавление не оставляло следов.
+    // Текст целиком проверяется блоками, ошибочное слово ищется, только если спец-символы есть
+    if (HasControlCharacters(document)) {
+        ForEachWord(document, [](string_view word) {
+            if (!IsValidWord(word)) {
+                throw invalid_argument("Word "s + string{ word } + " is invalid"s);
+            }
+            });
+    }
+    if (mutation_log_ != nullptr) {
+        log_sequence_ = mutation_log_->AppendAddDocument(document_id, document, status, ratings);
+    }
 
-    const double inv_word_count = 1.0 / words.size();
-    for (string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_to_words_and_freqs_[document_id][word] += inv_word_count;
+    // Один поиск в словаре на слово дает и его id, и признак стоп-слова.
+    // Слова разбираются по ходу, без промежуточного вектора
+    vector<int> term_ids;
+    ForEachWord(document, [&](string_view word) {
+        const auto term = terms_.Intern(word);
+        if (!term.is_stop) {
+            term_ids.push_back(term.id);
+        }
+        });
+    ResizeTermColumns();
+
+    DocumentTerms terms = CountDocumentTerms(move(term_ids));
+    const int internal_id = AppendDocumentRow(document_id, status, ratings, terms);
+
+    // Внутренние id растут монотонно, поэтому вхождения дописываются в конец списков
+    for (const auto& [term_id, count] : terms.term_counts) {
+        PostingList& postings = write_postings_[term_id];
+        if (postings.IsEmpty()) {
+            write_term_ids_.push_back(term_id);
+        }
+        postings.Add(internal_id, count, count * terms.inv_word_count);
+        ++term_document_counts_[term_id];
+    }
+    SealWriteSegment();
+    ++generation_;
+}
+
+// Добавляет документы пакетом: разбор текста и построение вхождений идут параллельно.
+// Результат тот же, что у AddDocument для каждого документа по порядку
+void SearchServer::AddDocuments(const vector<NewDocument>& documents) {
+    // Пакет обрабатывается частями, чтобы промежуточные данные оставались в кэше. Часть не выходит
+    // за пределы пишущего сегмента: он запечатывается после части, и сегменты получаются того же
+    // размера, что и при добавлении по одному
+    for (auto first = documents.begin(); first != documents.end();) {
+        const int write_segment_room = WRITE_SEGMENT_SIZE
+            - (static_cast<int>(document_external_ids_.size()) - write_first_document_id_);
+        const auto last = first + min<ptrdiff_t>({ static_cast<ptrdiff_t>(ADD_BATCH_PART_SIZE),
+            write_segment_room, documents.end() - first });
+        first += AddValidDocuments(first, last);
+        if (first != last) {
+            // AddDocument бросает для ошибочного документа то же исключение, что и при добавлении по одному
+            AddDocument(first->id, first->text, first->status, first->ratings);
+        }
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
-    document_ids_.insert(document_id);
 }
 
 // Поиск документов с заданным статусом
-// Вызывает метод FindTopDocuments с предикатом
-vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+// Вызывает метод FindTopDocuments с последовательной политикой исполнения
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status,
+    size_t max_count) const {
+    return SearchServer::FindTopDocuments(execution::seq, raw_query, status, max_count);
 }
 
 // Поиск документов по умолчанию (только актуальные)
@@ -50,43 +96,197 @@ vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
+// Поиск документов с заданным статусом в пределах бюджета
+SearchResult SearchServer::FindTopDocuments(string_view raw_query, const SearchBudget& budget,
+    DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(execution::seq, raw_query, budget, status, max_count);
+}
+
+// Разбирает и проверяет запрос, находит списки вхождений и IDF его слов.
+// Слова, которых пока нет в словаре, сохраняются: они могут появиться в новых документах
+SearchServer::PreparedQuery SearchServer::PrepareQuery(string_view raw_query) const {
+    PreparedQuery prepared;
+    ForEachWord(raw_query, [&](string_view word) {
+        const auto query_word = ParseQueryWord(word);
+        if (!query_word.term.is_stop) {
+            auto& words = query_word.is_minus ? prepared.minus_words_ : prepared.plus_words_;
+            words.emplace_back(query_word.is_minus ? word.substr(1) : word);
+        }
+        });
+
+    for (auto* words : { &prepared.plus_words_, &prepared.minus_words_ }) {
+        sort(words->begin(), words->end());
+        words->erase(unique(words->begin(), words->end()), words->end());
+    }
+
+    prepared.epoch_ = epoch_.Get();
+    prepared.generation_ = generation_;
+    LookupQueryWords(prepared.plus_words_, prepared.minus_words_, prepared.query_);
+    ResolveQuery(prepared.query_, prepared.resolved_);
+    return prepared;
+}
+
+// Поиск по подготовленному запросу документов с заданным статусом (по умолчанию актуальных)
+vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status,
+    size_t max_count) const {
+    return FindTopDocuments(execution::seq, query, status, max_count);
+}
+
+// Поиск по подготовленному запросу документов с заданным статусом в пределах бюджета
+SearchResult SearchServer::FindTopDocuments(const PreparedQuery& query, const SearchBudget& budget,
+    DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(execution::seq, query, budget, status, max_count);
+}
+
+// Поиск по пакету запросов документов с заданным статусом, выдачи идут в порядке запросов
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(const vector<string>& raw_queries,
+    DocumentStatus status, size_t max_count) const {
+    return FindTopDocumentsBatch(execution::seq, raw_queries, status, max_count);
+}
+
+// Поиск по пакету запросов с последовательной политикой исполнения
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(const execution::sequenced_policy& policy,
+    const vector<string>& raw_queries, DocumentStatus status, size_t max_count) const {
+    return FindBatchTopDocuments(policy, raw_queries, status, max_count, nullptr);
+}
+
+// Поиск по пакету запросов с параллельной политикой исполнения
+vector<vector<Document>> SearchServer::FindTopDocumentsBatch(const execution::parallel_policy& policy,
+    const vector<string>& raw_queries, DocumentStatus status, size_t max_count) const {
+    return FindBatchTopDocuments(policy, raw_queries, status, max_count, nullptr);
+}
+
+// Поиск по пакету запросов в пределах общего бюджета
+vector<SearchResult> SearchServer::FindTopDocumentsBatch(const vector<string>& raw_queries,
+    const SearchBudget& budget, DocumentStatus status, size_t max_count) const {
+    return FindTopDocumentsBatch(execution::seq, raw_queries, budget, status, max_count);
+}
+
+// Поиск по пакету запросов в пределах бюджета с последовательной политикой исполнения
+vector<SearchResult> SearchServer::FindTopDocumentsBatch(const execution::sequenced_policy& policy,
+    const vector<string>& raw_queries, const SearchBudget& budget, DocumentStatus status,
+    size_t max_count) const {
+    return FindBudgetedBatchTopDocuments(policy, raw_queries, budget, status, max_count);
+}
+
+// Поиск по пакету запросов в пределах бюджета с параллельной политикой исполнения
+vector<SearchResult> SearchServer::FindTopDocumentsBatch(const execution::parallel_policy& policy,
+    const vector<string>& raw_queries, const SearchBudget& budget, DocumentStatus status,
+    size_t max_count) const {
+    return FindBudgetedBatchTopDocuments(policy, raw_queries, budget, status, max_count);
+}
+
+// Ищет документы по пакету запросов в пределах бюджета. Остановка прерывает весь пакет,
+// поэтому частичными помечаются выдачи всех запросов
+template <typename Policy>
+vector<SearchResult> SearchServer::FindBudgetedBatchTopDocuments(const Policy policy,
+    const vector<string>& raw_queries, const SearchBudget& budget, DocumentStatus status,
+    size_t max_count) const {
+    BudgetMeter meter(budget);
+    vector<vector<Document>> documents = FindBatchTopDocuments(policy, raw_queries, status, max_count, &meter);
+    const bool is_partial = meter.IsExhausted();
+
+    vector<SearchResult> result(documents.size());
+    for (size_t query = 0; query < documents.size(); ++query) {
+        result[query].documents = move(documents[query]);
+        result[query].is_partial = is_partial;
+    }
+    return result;
+}
+
+// Ищет документы по пакету запросов с последовательной политикой исполнения
+vector<vector<Document>> SearchServer::FindBatchTopDocuments(const execution::sequenced_policy&,
+    const vector<string>& raw_queries, DocumentStatus status, size_t max_count, BudgetMeter* budget) const {
+    const QueryBatch batch = PrepareQueryBatch(raw_queries);
+    vector<TopDocuments> top_documents(batch.query_count, TopDocuments(max_count));
+    visit([&](const auto& ranker) {
+        FindBatchDocuments(batch, ranker, status, 0, static_cast<int>(document_external_ids_.size()),
+            top_documents, budget);
+    }, batch.resolved.ranker);
+
+    vector<vector<Document>> result;
+    result.reserve(batch.query_count);
+    for (TopDocuments& query_top_documents : top_documents) {
+        result.push_back(query_top_documents.Extract());
+    }
+    return result;
+}
+
+// Ищет документы по пакету запросов с параллельной политикой исполнения. Как и при параллельном
+// поиске по одному запросу, пространство внутренних id делится на диапазоны со своими
+// накопителями, а лучшие документы диапазонов затем сводятся по порядку диапазонов
+vector<vector<Document>> SearchServer::FindBatchTopDocuments(const execution::parallel_policy&,
+    const vector<string>& raw_queries, DocumentStatus status, size_t max_count, BudgetMeter* budget) const {
+    const QueryBatch batch = PrepareQueryBatch(raw_queries);
+    const size_t id_count = document_external_ids_.size();
+    const size_t chunk_count = max<size_t>(thread::hardware_concurrency(), 1) * 4;
+    const size_t chunk_size = (id_count + chunk_count - 1) / chunk_count;
+    vector<vector<TopDocuments>> chunk_top_documents(chunk_count,
+        vector<TopDocuments>(batch.query_count, TopDocuments(max_count)));
+
+    vector<size_t> chunks(chunk_count);
+    iota(chunks.begin(), chunks.end(), 0);
+    visit([&](const auto& ranker) {
+        for_each(execution::par, chunks.begin(), chunks.end(), [&](size_t chunk) {
+            const int begin = static_cast<int>(min(id_count, chunk * chunk_size));
+            const int end = static_cast<int>(min(id_count, (chunk + 1) * chunk_size));
+            FindBatchDocuments(batch, ranker, status, begin, end, chunk_top_documents[chunk], budget);
+            });
+    }, batch.resolved.ranker);
+
+    vector<vector<Document>> result;
+    result.reserve(batch.query_count);
+    for (size_t query = 0; query < batch.query_count; ++query) {
+        TopDocuments top_documents(max_count);
+        for (auto& query_top_documents : chunk_top_documents) {
+            for (const Document& document : query_top_documents[query].Extract()) {
+                top_documents.Add(document);
+            }
+        }
+        result.push_back(top_documents.Extract());
+    }
+    return result;
+}
+
 // Возвращает кол-во документов
 int SearchServer::GetDocumentCount() const {
-    return static_cast<int>(documents_.size());
+    return static_cast<int>(document_ids_.size());
 }
 
-// Возвращает итератор на начало document_ids_
-set<int>::iterator SearchServer::begin() {
-    return document_ids_.begin();
+// Возвращает итератор на первый id документа
+SearchServer::DocumentIdIterator SearchServer::begin() const {
+    return DocumentIdIterator(document_ids_.begin());
 }
 
-// Возвращает итератор на конец document_ids_
-set<int>::iterator SearchServer::end() {
-    return document_ids_.end();
+// Возвращает итератор на конец последовательности id документов
+SearchServer::DocumentIdIterator SearchServer::end() const {
+    return DocumentIdIterator(document_ids_.end());
 }
 
 // Сверяет запрос с конкретным документом, возвращает совпавшие слова и статус документа
 SearchServer::MatchResult SearchServer::MatchDocument(string_view raw_query,
     int document_id) const {
-    const auto query = ParseQuery(raw_query);
+    Query query;
+    ParseQuery(raw_query, query);
+    const int internal_id = GetInternalId(document_id);
+    const DocumentStatus status = document_statuses_[internal_id];
+    const auto term_counts = GetDocumentTerms(internal_id);
 
-    for (string_view word : query.minus_words) {
-        if (id_to_words_and_freqs_.at(document_id).count(word) != 0) {
-            return { {}, documents_.at(document_id).status };
+    for (int term_id : query.minus_terms) {
+        if (HasTerm(term_counts, term_id)) {
+            return { vector<string_view>{}, status };
         }
     }
 
     vector<string_view> matched_words;
-    for (string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id) > 0) {
-            matched_words.push_back(word);
+    for (int term_id : query.plus_terms) {
+        if (HasTerm(term_counts, term_id)) {
+            matched_words.push_back(terms_.GetWord(term_id));
         }
     }
+    sort(matched_words.begin(), matched_words.end());
 
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, status };
 }
 
 // Сверяет запрос с конкретным документом с заданной политикой исполнения (последовательной),
@@ -100,29 +300,31 @@ SearchServer::MatchResult SearchServer::MatchDocument(const execution::sequenced
 // возвращает совпавшие слова и статус документа
 SearchServer::MatchResult SearchServer::MatchDocument(const execution::parallel_policy&,
     string_view raw_query, int document_id) const {
-    const auto query = ParseQuery(raw_query, true);
-    const auto& status = documents_.at(document_id).status;
-    const auto& doc = id_to_words_and_freqs_.at(document_id);
+    Query query;
+    ParseQuery(raw_query, query, true);
+    const int internal_id = GetInternalId(document_id);
+    const DocumentStatus status = document_statuses_[internal_id];
+    const auto term_counts = GetDocumentTerms(internal_id);
 
-    if (any_of(execution::par, query.minus_words.begin(), query.minus_words.end(),
-        [&](string_view minus_word) {
-            return doc.find(minus_word) != doc.end();
+    if (any_of(execution::par, query.minus_terms.begin(), query.minus_terms.end(),
+        [&](int term_id) {
+            return HasTerm(term_counts, term_id);
         })) {
-        return { {}, status };
+        return { vector<string_view>{}, status };
     }
 
-    vector<string_view> matched_words(query.plus_words.size(), ""sv);
+    vector<string_view> matched_words(query.plus_terms.size(), ""sv);
 
-    transform(execution::par, query.plus_words.begin(), query.plus_words.end(),
-        matched_words.begin(), [&](string_view plus_word) {
-            return doc.find(plus_word) != doc.end() ? plus_word : ""sv;
+    transform(execution::par, query.plus_terms.begin(), query.plus_terms.end(),
+        matched_words.begin(), [&](int term_id) {
+            return HasTerm(term_counts, term_id) ? terms_.GetWord(term_id) : ""sv;
         });
 
     sort(execution::par, matched_words.begin(), matched_words.end());
     matched_words.erase(unique(execution::par, matched_words.begin(), matched_words.end()), matched_words.end());
     
     // Удаляем первое пустое слово при наличии
-    if (matched_words[0].empty()) {
+    if (!matched_words.empty() && matched_words[0].empty()) {
         matched_words.erase(matched_words.begin());
     }
     
@@ -130,33 +332,63 @@ SearchServer::MatchResult SearchServer::MatchDocument(const execution::parallel_
 }
 
 // Возвращает частоту слов в документе по его id
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static map<string_view, double> empty_container{}; // Пустой контейнер
+map<string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
+    map<string_view, double> word_freqs;
 
-    auto it = id_to_words_and_freqs_.find(document_id);
-    return (it != id_to_words_and_freqs_.end()
-        ? it->second
-        : empty_container);
+    auto it = document_ids_.find(document_id);
+    if (it != document_ids_.end()) {
+        const double inv_word_count = document_inv_word_counts_[it->second];
+        for (const auto& [term_id, count] : GetDocumentTerms(it->second)) {
+            word_freqs.emplace(terms_.GetWord(term_id), count * inv_word_count);
+        }
+    }
+    return word_freqs;
 }
 
 // Удаление документа по его id
 void SearchServer::RemoveDocument(int document_id) {
-    const auto list_iterator_to_remove = find(document_ids_.begin(), document_ids_.end(), document_id);
+    const auto list_iterator_to_remove = document_ids_.find(document_id);
 
     // Если такого id не существует, find вернет итератор на конец списка
     if (list_iterator_to_remove == document_ids_.end()) {
         return;
     }
 
+    if (mutation_log_ != nullptr) {
+        log_sequence_ = mutation_log_->AppendRemoveDocument(document_id);
+    }
+
+    const int internal_id = list_iterator_to_remove->second;
     document_ids_.erase(list_iterator_to_remove); // Удаление из списка id
-    documents_.erase(document_id); // Удаление из документов
-    const auto words_from_doc = id_to_words_and_freqs_.at(document_id); // Создаем контейнер слов из удаляемого документа
-    id_to_words_and_freqs_.erase(document_id);
 
-    // Итерируемся по словам из удаляемого документа
-    for (const auto& [word, _] : words_from_doc) {
-        word_to_document_freqs_.at(word).erase(document_id);
+    // Сегменты не меняются: документ помечается удаленным, его вхождения уйдут при слиянии
+    document_is_removed_[internal_id] = true;
+
+    // По счетчику удаленных документов сегмента StartMerge решает, пора ли переписать сегмент
+    if (internal_id >= write_first_document_id_) {
+        ++write_removed_count_;
+    }
+    else {
+        const auto segment = upper_bound(segments_.begin(), segments_.end(), internal_id,
+            [](int id, const shared_ptr<const Segment>& segment) {
+                return id < segment->GetFirstDocumentId();
+            });
+        ++segment_removed_counts_[segment - segments_.begin() - 1];
+    }
+    total_word_count_ -= document_word_counts_[internal_id];
+    ReleaseDocumentTerms(internal_id, GetDocumentTerms(internal_id));
+
+    // Уплотнение ждет, пока удаленных документов станет не меньше, чем действующих: так его
+    // стоимость делится между удалениями, а столбцы держат не больше двух строк на действующий
+    // документ. Нижний порог не дает уплотнять маленький индекс на каждом удалении
+    const size_t removed_count = document_external_ids_.size() - document_ids_.size();
+    if (removed_count >= static_cast<size_t>(WRITE_SEGMENT_SIZE) && removed_count >= document_ids_.size()) {
+        CompactDocuments();
+    }
+    else {
+        PollMerge();
     }
+    ++generation_;
 }
 
 // Удаление документа по его id по заданной политике выполнения - последовательной
@@ -164,39 +396,216 @@ void SearchServer::RemoveDocument(const execution::sequenced_policy&, int docume
     RemoveDocument(document_id);
 }
 
-// Удаление документа по его id по заданной политике выполнения - последовательной
+// Удаление документа по его id по заданной политике выполнения - параллельной.
+// Удаление лишь помечает документ и уменьшает счетчики его слов, распараллеливать нечего
 void SearchServer::RemoveDocument(const execution::parallel_policy&, int document_id) {
-    // Если такого id не существует, find вернет итератор на конец списка
-    const auto list_iterator_to_remove = document_ids_.find(document_id);
-    if (list_iterator_to_remove == document_ids_.end()) {
-        return;
+    RemoveDocument(document_id);
+}
+
+// Задает модель ранжирования документов. Выдачи в кэше и веса слов подготовленных запросов
+// посчитаны прежней моделью, поэтому начинается новое поколение
+void SearchServer::SetScoringModel(ScoringModel scoring_model) {
+    scoring_model_ = move(scoring_model);
+    ++generation_;
+}
+
+// Включает кэш выдач поиска по статусу и по предикатам с ключом на capacity запросов,
+// 0 отключает кэш
+void SearchServer::EnableQueryCache(size_t capacity) {
+    query_cache_ = capacity > 0 ? make_unique<QueryCache>(capacity) : nullptr;
+}
+
+// Возвращает кол-во попаданий и промахов кэша запросов
+QueryCache::Statistics SearchServer::GetQueryCacheStatistics() const {
+    return query_cache_ ? query_cache_->GetStatistics() : QueryCache::Statistics{};
+}
+
+// Дожидается фоновых слияний сегментов, пока политика слияния их требует
+void SearchServer::WaitForMerges() {
+    while (merge_result_.valid()) {
+        merge_result_.wait();
+        PollMerge();
     }
-    document_ids_.erase(list_iterator_to_remove); // Удаление из списка id
-    
-    // Для быстрой работы параллельных алгоритмов, создадим вектор указателей на слова, 
-    // содержащиеся в документе с номером document_id
-    vector<string_view> svs(id_to_words_and_freqs_.at(document_id).size());
-    transform(execution::par,
-        id_to_words_and_freqs_.at(document_id).begin(), id_to_words_and_freqs_.at(document_id).end(),
-        svs.begin(), [](const auto& word_freqs) {
-            return word_freqs.first;
-        });
+}
 
-    for_each(execution::par,
-        svs.begin(), svs.end(),
-        [&](string_view ptr) {
-            word_to_document_freqs_.at(ptr).erase(document_id);
-            return;
+// Сохраняет стоп-слова, словарь, списки вхождений, слова и данные документов в двоичный снимок.
+// Снимок пишется во временный файл, который затем заменяет path. Бросает runtime_error
+void SearchServer::SaveSnapshot(const string& path) const {
+    SnapshotWriter writer(path);
+    writer.Write(log_sequence_);
+
+    // Словарь: длины и признаки стоп-слов по id, затем текст слов подряд
+    const size_t term_count = terms_.Size();
+    vector<uint32_t> word_lengths(term_count);
+    vector<uint8_t> is_stop(term_count);
+    string text;
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        const string_view word = terms_.GetWord(static_cast<int>(term_id));
+        word_lengths[term_id] = static_cast<uint32_t>(word.size());
+        is_stop[term_id] = terms_.IsStopWord(static_cast<int>(term_id));
+        text += word;
+    }
+    writer.Write(static_cast<uint64_t>(term_count));
+    writer.WriteArray(word_lengths.data(), term_count);
+    writer.WriteArray(is_stop.data(), term_count);
+    writer.Write(static_cast<uint64_t>(text.size()));
+    writer.WriteArray(text.data(), text.size());
+
+    // Столбцы документов по внутренним id
+    const size_t id_count = document_external_ids_.size();
+    writer.Write(static_cast<uint64_t>(id_count));
+    writer.WriteArray(document_external_ids_.data(), id_count);
+    writer.WriteArray(document_ratings_.data(), id_count);
+    writer.WriteArray(document_statuses_.data(), id_count);
+    writer.WriteArray(document_inv_word_counts_.data(), id_count);
+
+    // Действующие документы: пары (внешний id, внутренний id) по возрастанию внешнего
+    vector<int32_t> live_ids;
+    for (const auto& [document_id, internal_id] : document_ids_) {
+        live_ids.push_back(document_id);
+        live_ids.push_back(internal_id);
+    }
+    writer.Write(static_cast<uint64_t>(document_ids_.size()));
+    writer.WriteArray(live_ids.data(), live_ids.size());
+
+    // Слова документов: смещения и закодированные данные подряд
+    vector<uint64_t> offsets(id_count + 1, 0);
+    for (size_t internal_id = 0; internal_id < id_count; ++internal_id) {
+        offsets[internal_id + 1] = offsets[internal_id] + document_terms_[internal_id].size();
+    }
+    writer.WriteArray(offsets.data(), offsets.size());
+    writer.WriteArray<uint8_t>(nullptr, 0); // Выравнивает начало общего массива данных
+    for (const auto& encoded_terms : document_terms_) {
+        writer.AppendArray(encoded_terms.data(), encoded_terms.size());
+    }
+
+    // Вхождения слова из всех сегментов сохраняются одним списком без удаленных документов
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        PostingList postings;
+        GetTermPostings(static_cast<int>(term_id)).ForEach([&](int internal_id, int count) {
+            if (!document_is_removed_[internal_id]) {
+                postings.Add(internal_id, count, count * document_inv_word_counts_[internal_id]);
+            }
         });
-    
-    documents_.erase(document_id); // Удаление из документов
+        postings.Save(writer);
+    }
+    writer.Finish();
+}
+
+// Загружает сервер из снимка. Файл отображается в память: списки вхождений и текст слов
+// читаются прямо из него и копируются лишь при изменении. Бросает runtime_error, если файл
+// не открывается, и invalid_argument, если он поврежден или другой версии
+SearchServer SearchServer::LoadSnapshot(const string& path, SnapshotVerification verification) {
+    SearchServer server;
+    server.snapshot_file_ = make_unique<MappedFile>(path);
+    SnapshotReader reader(server.snapshot_file_->GetData(), server.snapshot_file_->GetSize(), verification);
+    server.log_sequence_ = reader.Read<uint64_t>();
 
-    id_to_words_and_freqs_.erase(document_id);
+    const size_t term_count = static_cast<size_t>(reader.Read<uint64_t>());
+    const uint32_t* word_lengths = reader.ReadArray<uint32_t>(term_count);
+    const uint8_t* is_stop = reader.ReadArray<uint8_t>(term_count);
+    const size_t text_size = static_cast<size_t>(reader.Read<uint64_t>());
+    const char* text = reader.ReadArray<char>(text_size);
+
+    vector<string_view> words(term_count);
+    size_t text_offset = 0;
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        if (word_lengths[term_id] > text_size - text_offset) {
+            throw invalid_argument("Snapshot dictionary is corrupted"s);
+        }
+        words[term_id] = string_view(text + text_offset, word_lengths[term_id]);
+        text_offset += word_lengths[term_id];
+    }
+    server.terms_.Restore(move(words), vector<char>(is_stop, is_stop + term_count));
+
+    const size_t id_count = static_cast<size_t>(reader.Read<uint64_t>());
+    const int* external_ids = reader.ReadArray<int>(id_count);
+    const int* ratings = reader.ReadArray<int>(id_count);
+    const DocumentStatus* statuses = reader.ReadArray<DocumentStatus>(id_count);
+    const double* inv_word_counts = reader.ReadArray<double>(id_count);
+    server.document_external_ids_.assign(external_ids, external_ids + id_count);
+    server.document_ratings_.assign(ratings, ratings + id_count);
+    server.document_statuses_.assign(statuses, statuses + id_count);
+    server.document_inv_word_counts_.assign(inv_word_counts, inv_word_counts + id_count);
+
+    const size_t live_count = static_cast<size_t>(reader.Read<uint64_t>());
+    const int32_t* live_ids = reader.ReadArray<int32_t>(live_count * 2);
+    for (size_t i = 0; i < live_count; ++i) {
+        if (live_ids[2 * i + 1] < 0 || static_cast<size_t>(live_ids[2 * i + 1]) >= id_count) {
+            throw invalid_argument("Snapshot document ids are corrupted"s);
+        }
+        server.document_ids_.emplace_hint(server.document_ids_.end(), live_ids[2 * i], live_ids[2 * i + 1]);
+    }
+
+    // Кол-во слов документа восстанавливается из обратной величины, хранимой в снимке
+    server.document_word_counts_.resize(id_count);
+    for (size_t internal_id = 0; internal_id < id_count; ++internal_id) {
+        server.document_word_counts_[internal_id] = static_cast<int>(lround(1.0 / inv_word_counts[internal_id]));
+    }
+    for (const auto& [document_id, internal_id] : server.document_ids_) {
+        server.total_word_count_ += server.document_word_counts_[internal_id];
+    }
+
+    const uint64_t* offsets = reader.ReadArray<uint64_t>(id_count + 1);
+    const uint8_t* encoded_terms = reader.ReadArray<uint8_t>(static_cast<size_t>(offsets[id_count]));
+    server.document_terms_.resize(id_count);
+    for (size_t internal_id = 0; internal_id < id_count; ++internal_id) {
+        if (offsets[internal_id] > offsets[internal_id + 1]) {
+            throw invalid_argument("Snapshot document words are corrupted"s);
+        }
+        server.document_terms_[internal_id].assign(encoded_terms + offsets[internal_id],
+            encoded_terms + offsets[internal_id + 1]);
+    }
+
+    // Снимок загружается одним запечатанным сегментом
+    vector<int> term_ids;
+    vector<PostingList> term_postings;
+    server.ResizeTermColumns();
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        PostingList postings = PostingList::Map(reader);
+        if (!postings.IsEmpty()) {
+            server.term_document_counts_[term_id] = static_cast<int>(postings.Size());
+            term_ids.push_back(static_cast<int>(term_id));
+            term_postings.push_back(move(postings));
+        }
+    }
+    server.segments_.push_back(make_shared<const Segment>(0, static_cast<int>(id_count),
+        ComputeSegmentLevel(server.document_ids_.size()), static_cast<int>(server.document_ids_.size()),
+        move(term_ids), move(term_postings)));
+    server.segment_removed_counts_.push_back(0);
+    server.write_first_document_id_ = static_cast<int>(id_count);
+
+    server.document_is_removed_.assign(id_count, true);
+    for (const auto& [_, internal_id] : server.document_ids_) {
+        server.document_is_removed_[internal_id] = false;
+    }
+    return server;
 }
 
-// Возвращает true, если строка является стоп-словом
-bool SearchServer::IsStopWord(string_view word) const {
-    return stop_words_.count(word) > 0;
+// Подключает журнал изменений: применяет записи журнала новее загруженного снимка, после чего
+// добавление и удаление документов сначала записываются в журнал. nullptr отключает журнал
+void SearchServer::AttachMutationLog(MutationLog* mutation_log) {
+    // Повторно применяемые записи не пишутся в журнал заново
+    mutation_log_ = nullptr;
+    if (mutation_log == nullptr) {
+        return;
+    }
+
+    mutation_log->Replay(log_sequence_, [this](const Mutation& mutation) {
+        if (mutation.type == Mutation::Type::ADD_DOCUMENT) {
+            AddDocument(mutation.document_id, mutation.document, mutation.status, mutation.ratings);
+        }
+        else {
+            RemoveDocument(mutation.document_id);
+        }
+        log_sequence_ = mutation.sequence;
+        });
+    mutation_log_ = mutation_log;
+}
+
+// Возвращает номер последней записи журнала, учтенной в сервере
+uint64_t SearchServer::GetLogSequence() const {
+    return log_sequence_;
 }
 
 // Возвращает true, если строка не содержит спец-символы
@@ -207,18 +616,426 @@ bool SearchServer::IsValidWord(string_view word) {
         });
 }
 
-// Возвращает вектор строк без стоп-слов
-vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
-    vector<string_view> words;
-    for (string_view word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw invalid_argument("Word "s + string{ word } + " is invalid"s);
+// Уменьшает счетчики документов слов удаляемого документа, освобождает слова, которых
+// не осталось ни в одном документе, и память под список слов документа.
+// В пишущем сегменте у освобожденного слова остаются лишь вхождения удаленных документов,
+// поэтому его список очищается и не достается слову, которое получит тот же id.
+// В запечатанных сегментах такие вхождения отбрасываются при слиянии
+void SearchServer::ReleaseDocumentTerms(int internal_id, const vector<TermCount>& term_counts) {
+    for (const auto& [term_id, _] : term_counts) {
+        if (--term_document_counts_[term_id] == 0) {
+            terms_.Release(term_id);
+            write_postings_[term_id] = PostingList{};
         }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
+    }
+    document_terms_[internal_id] = vector<uint8_t>{};
+}
+
+// Добавляет документы до первого, на котором AddDocument бросил бы исключение,
+// и возвращает их кол-во
+size_t SearchServer::AddValidDocuments(vector<NewDocument>::const_iterator first,
+    vector<NewDocument>::const_iterator last) {
+    PollMerge();
+
+    struct ParsedDocument {
+        vector<string_view> words;
+        vector<size_t> hashes;
+        bool has_invalid_word = false;
+    };
+
+    // Разбор и проверка слов не меняют сервер, поэтому идут параллельно
+    const size_t document_count = static_cast<size_t>(last - first);
+    vector<ParsedDocument> parsed(document_count);
+    vector<size_t> indexes(document_count);
+    iota(indexes.begin(), indexes.end(), 0);
+    for_each(execution::par, indexes.begin(), indexes.end(), [&](size_t i) {
+        ParsedDocument& document = parsed[i];
+        document.words = SplitIntoWords(first[i].text, document.has_invalid_word);
+        document.hashes.resize(document.words.size());
+        transform(document.words.begin(), document.words.end(), document.hashes.begin(), TermDictionary::Hash);
+        });
+
+    size_t valid_count = 0;
+    set<int> batch_ids;
+    for (; valid_count < document_count; ++valid_count) {
+        const int document_id = first[valid_count].id;
+        if (document_id < 0 || document_ids_.count(document_id) > 0
+            || !batch_ids.insert(document_id).second || parsed[valid_count].has_invalid_word) {
+            break;
+        }
+    }
+
+    // Новые слова получают id в том же порядке, что и при добавлении документов по одному
+    vector<vector<int>> term_ids(valid_count);
+    for (size_t i = 0; i < valid_count; ++i) {
+        if (mutation_log_ != nullptr) {
+            log_sequence_ = mutation_log_->AppendAddDocument(first[i].id, first[i].text, first[i].status,
+                first[i].ratings);
+        }
+        term_ids[i].reserve(parsed[i].words.size());
+        for (size_t word = 0; word < parsed[i].words.size(); ++word) {
+            const auto term = terms_.Intern(parsed[i].words[word], parsed[i].hashes[word]);
+            if (!term.is_stop) {
+                term_ids[i].push_back(term.id);
+            }
         }
     }
-    return words;
+    ResizeTermColumns();
+
+    vector<DocumentTerms> document_terms(valid_count);
+    transform(execution::par, term_ids.begin(), term_ids.end(), document_terms.begin(),
+        [](vector<int>& ids) {
+            return CountDocumentTerms(move(ids));
+        });
+
+    const int first_internal_id = static_cast<int>(document_external_ids_.size());
+    for (size_t i = 0; i < valid_count; ++i) {
+        AppendDocumentRow(first[i].id, first[i].status, first[i].ratings, document_terms[i]);
+    }
+
+    // Частичные индексы: каждый поток раскладывает вхождения своих документов по диапазонам
+    // id слов подсчетом, сохраняя внутри диапазона порядок документов
+    struct Occurrence {
+        int term_id;
+        int internal_id;
+        int count;
+    };
+    struct PartialIndex {
+        vector<Occurrence> occurrences;
+        vector<size_t> range_offsets; // Начало вхождений каждого диапазона
+    };
+    const size_t term_count = terms_.Size();
+    const size_t part_count = min<size_t>(max<size_t>(thread::hardware_concurrency(), 1), valid_count);
+    const size_t range_count = part_count * 16;
+    const auto get_range = [&](int term_id) {
+        return static_cast<size_t>(term_id) * range_count / term_count;
+    };
+
+    vector<PartialIndex> parts(part_count);
+    vector<size_t> part_indexes(part_count);
+    iota(part_indexes.begin(), part_indexes.end(), 0);
+    for_each(execution::par, part_indexes.begin(), part_indexes.end(), [&](size_t part) {
+        const size_t part_begin = valid_count * part / part_count;
+        const size_t part_end = valid_count * (part + 1) / part_count;
+        PartialIndex& index = parts[part];
+        index.range_offsets.assign(range_count + 1, 0);
+        for (size_t i = part_begin; i < part_end; ++i) {
+            for (const auto& [term_id, _] : document_terms[i].term_counts) {
+                ++index.range_offsets[get_range(term_id) + 1];
+            }
+        }
+        partial_sum(index.range_offsets.begin(), index.range_offsets.end(), index.range_offsets.begin());
+
+        vector<size_t> positions(index.range_offsets.begin(), index.range_offsets.end() - 1);
+        index.occurrences.resize(index.range_offsets.back());
+        for (size_t i = part_begin; i < part_end; ++i) {
+            for (const auto& [term_id, count] : document_terms[i].term_counts) {
+                index.occurrences[positions[get_range(term_id)]++] =
+                    { term_id, first_internal_id + static_cast<int>(i), count };
+            }
+        }
+        });
+
+    // Слияние: списки разных слов независимы, поэтому диапазоны сливаются параллельно.
+    // Части дописываются в списки по порядку, и внутренние id в них остаются возрастающими
+    vector<size_t> range_indexes(range_count);
+    iota(range_indexes.begin(), range_indexes.end(), 0);
+    vector<vector<int>> range_new_term_ids(range_count);
+    for_each(execution::par, range_indexes.begin(), range_indexes.end(), [&](size_t range) {
+        for (const PartialIndex& index : parts) {
+            for (size_t i = index.range_offsets[range]; i < index.range_offsets[range + 1]; ++i) {
+                const Occurrence& occurrence = index.occurrences[i];
+                PostingList& postings = write_postings_[occurrence.term_id];
+                if (postings.IsEmpty()) {
+                    range_new_term_ids[range].push_back(occurrence.term_id);
+                }
+                postings.Add(occurrence.internal_id, occurrence.count,
+                    occurrence.count * document_inv_word_counts_[occurrence.internal_id]);
+                ++term_document_counts_[occurrence.term_id];
+            }
+        }
+        });
+    for (const vector<int>& new_term_ids : range_new_term_ids) {
+        write_term_ids_.insert(write_term_ids_.end(), new_term_ids.begin(), new_term_ids.end());
+    }
+    SealWriteSegment();
+    ++generation_;
+    return valid_count;
+}
+
+// Считает повторения слов документа по их id, стоп-слова уже исключены
+SearchServer::DocumentTerms SearchServer::CountDocumentTerms(vector<int> term_ids) {
+    sort(term_ids.begin(), term_ids.end());
+
+    DocumentTerms terms;
+    for (int term_id : term_ids) {
+        if (terms.term_counts.empty() || terms.term_counts.back().term_id != term_id) {
+            terms.term_counts.push_back({ term_id, 0 });
+        }
+        ++terms.term_counts.back().count;
+    }
+
+    int previous_term_id = 0;
+    for (const auto& [term_id, count] : terms.term_counts) {
+        AppendVarint(terms.encoded_terms, static_cast<uint32_t>(term_id - previous_term_id));
+        AppendVarint(terms.encoded_terms, static_cast<uint32_t>(count));
+        previous_term_id = term_id;
+    }
+    terms.word_count = static_cast<int>(term_ids.size());
+    terms.inv_word_count = 1.0 / term_ids.size();
+    return terms;
+}
+
+// Заносит документ в столбцы и список id, возвращает его внутренний id
+int SearchServer::AppendDocumentRow(int document_id, DocumentStatus status, const vector<int>& ratings,
+    DocumentTerms& terms) {
+    const int internal_id = static_cast<int>(document_external_ids_.size());
+    document_terms_.push_back(move(terms.encoded_terms));
+    document_inv_word_counts_.push_back(terms.inv_word_count);
+    document_word_counts_.push_back(terms.word_count);
+    total_word_count_ += terms.word_count;
+    document_external_ids_.push_back(document_id);
+    document_ratings_.push_back(ComputeAverageRating(ratings));
+    document_statuses_.push_back(status);
+    document_is_removed_.push_back(false);
+    document_ids_.emplace(document_id, internal_id);
+    return internal_id;
+}
+
+// Расширяет столбцы по id слова до размера словаря
+void SearchServer::ResizeTermColumns() {
+    write_postings_.resize(terms_.Size());
+    term_document_counts_.resize(terms_.Size());
+}
+
+// Возвращает вхождения слова во всех сегментах
+TermPostings SearchServer::GetTermPostings(int term_id) const {
+    TermPostings postings;
+    for (const auto& segment : segments_) {
+        if (const PostingList* segment_postings = segment->Find(term_id)) {
+            postings.Add(segment_postings, segment->GetFirstDocumentId());
+        }
+    }
+    if (!write_postings_[term_id].IsEmpty()) {
+        postings.Add(&write_postings_[term_id], write_first_document_id_);
+    }
+    return postings;
+}
+
+// Запечатывает пишущий сегмент, если в нем накопилось WRITE_SEGMENT_SIZE документов
+void SearchServer::SealWriteSegment() {
+    if (static_cast<int>(document_external_ids_.size()) - write_first_document_id_ < WRITE_SEGMENT_SIZE) {
+        return;
+    }
+    segment_removed_counts_.push_back(write_removed_count_);
+    segments_.push_back(ExtractWriteSegment());
+    StartMerge();
+}
+
+// Переносит вхождения пишущего сегмента в запечатанный сегмент уровня 0 и начинает новый
+// пишущий сегмент
+shared_ptr<const Segment> SearchServer::ExtractWriteSegment() {
+    const int end_document_id = static_cast<int>(document_external_ids_.size());
+
+    // Списки освобожденных слов очищены, а id слова, освобожденного и снова занятого,
+    // записан в write_term_ids_ дважды: пустые списки в сегмент не попадают
+    sort(write_term_ids_.begin(), write_term_ids_.end());
+    vector<int> term_ids;
+    vector<PostingList> term_postings;
+    term_ids.reserve(write_term_ids_.size());
+    term_postings.reserve(write_term_ids_.size());
+    for (int term_id : write_term_ids_) {
+        if (write_postings_[term_id].IsEmpty()) {
+            continue;
+        }
+        term_ids.push_back(term_id);
+        term_postings.push_back(move(write_postings_[term_id]));
+        write_postings_[term_id] = PostingList{};
+    }
+    auto segment = make_shared<const Segment>(write_first_document_id_, end_document_id, 0,
+        end_document_id - write_first_document_id_, move(term_ids), move(term_postings));
+    write_term_ids_ = vector<int>{};
+    write_first_document_id_ = end_document_id;
+    write_removed_count_ = 0;
+    return segment;
+}
+
+// Устанавливает завершившееся фоновое слияние и запускает следующее, если оно нужно
+void SearchServer::PollMerge() {
+    if (merge_result_.valid()) {
+        if (merge_result_.wait_for(chrono::seconds(0)) != future_status::ready) {
+            return;
+        }
+        InstallMerge();
+    }
+    StartMerge();
+}
+
+// Запускает фоновое слияние первых MERGE_FACTOR соседних сегментов одного уровня, а если
+// таких нет - перезапись первого сегмента, где удалено много документов.
+// Ничего не делает, пока идет другое слияние
+void SearchServer::StartMerge() {
+    if (merge_result_.valid()) {
+        return;
+    }
+
+    size_t first = 0;
+    for (size_t i = 1; i <= segments_.size(); ++i) {
+        if (i < segments_.size() && segments_[i]->GetLevel() == segments_[first]->GetLevel()) {
+            continue;
+        }
+        if (i - first >= MERGE_FACTOR) {
+            break;
+        }
+        first = i;
+    }
+    size_t segment_count = MERGE_FACTOR;
+
+    // Сегмент верхнего уровня сливать может быть не с чем, и без перезаписи вхождения
+    // удаленных документов оставались бы в нем навсегда
+    if (first + MERGE_FACTOR > segments_.size()) {
+        for (first = 0; first < segments_.size(); ++first) {
+            const int removed_count = segment_removed_counts_[first];
+            if (removed_count > 0
+                && removed_count * TOMBSTONE_MERGE_RATIO >= segments_[first]->GetDocumentCount()) {
+                break;
+            }
+        }
+        if (first == segments_.size()) {
+            return;
+        }
+        segment_count = 1;
+    }
+
+    // Фоновый поток получает копии сегментов и столбцов своего диапазона и не трогает сервер
+    vector<shared_ptr<const Segment>> segments(segments_.begin() + first,
+        segments_.begin() + first + segment_count);
+    const int first_document_id = segments.front()->GetFirstDocumentId();
+    const int end_document_id = segments.back()->GetEndDocumentId();
+    vector<char> is_removed(document_is_removed_.begin() + first_document_id,
+        document_is_removed_.begin() + end_document_id);
+    vector<double> inv_word_counts(document_inv_word_counts_.begin() + first_document_id,
+        document_inv_word_counts_.begin() + end_document_id);
+    const int level = segments.front()->GetLevel() + (segment_count > 1 ? 1 : 0);
+
+    merge_first_segment_ = first;
+    merge_segment_count_ = segment_count;
+    merge_removed_count_ = accumulate(segment_removed_counts_.begin() + first,
+        segment_removed_counts_.begin() + first + segment_count, 0);
+    merge_result_ = async(launch::async,
+        [segments = move(segments), level, is_removed = move(is_removed),
+        inv_word_counts = move(inv_word_counts)]() {
+            return make_shared<const Segment>(Segment::Merge(segments, level, is_removed, inv_word_counts));
+        });
+}
+
+// Заменяет слитые сегменты результатом слияния
+void SearchServer::InstallMerge() {
+    const auto first = segments_.begin() + merge_first_segment_;
+    *first = merge_result_.get();
+    segments_.erase(first + 1, first + merge_segment_count_);
+
+    // В слитом сегменте остались вхождения лишь документов, удаленных во время слияния
+    const auto first_count = segment_removed_counts_.begin() + merge_first_segment_;
+    *first_count = accumulate(first_count, first_count + merge_segment_count_, 0) - merge_removed_count_;
+    segment_removed_counts_.erase(first_count + 1, first_count + merge_segment_count_);
+
+    // Списки вхождений, найденные подготовленными запросами, указывали в слитые сегменты
+    ++generation_;
+}
+
+// Уплотняет индекс: назначает действующим документам внутренние id подряд с сохранением
+// порядка, переписывает все сегменты вместе с пишущим в один, удаляет из столбцов строки
+// удаленных документов и освобождает текст освобожденных слов
+void SearchServer::CompactDocuments() {
+    // Идущее слияние работает с прежними id, поэтому его результат устанавливается до уплотнения
+    if (merge_result_.valid()) {
+        InstallMerge();
+    }
+
+    const size_t id_count = document_external_ids_.size();
+    vector<int> new_ids(id_count);
+    int live_count = 0;
+    for (size_t internal_id = 0; internal_id < id_count; ++internal_id) {
+        new_ids[internal_id] = document_is_removed_[internal_id] ? PostingList::NO_DOCUMENT : live_count++;
+    }
+
+    // Сегменты покрывают id подряд с нуля, так что new_ids годится для всех сразу
+    if (write_first_document_id_ < static_cast<int>(id_count)) {
+        segments_.push_back(ExtractWriteSegment());
+    }
+    auto compacted = make_shared<const Segment>(Segment::Renumber(segments_, 0, live_count,
+        ComputeSegmentLevel(live_count), new_ids, document_inv_word_counts_));
+    segments_.assign(1, move(compacted));
+    segment_removed_counts_.assign(1, 0);
+    write_first_document_id_ = live_count;
+    write_removed_count_ = 0;
+
+    // Новый id документа не больше прежнего, поэтому строки сдвигаются на месте
+    for (size_t internal_id = 0; internal_id < id_count; ++internal_id) {
+        const int new_id = new_ids[internal_id];
+        if (new_id == PostingList::NO_DOCUMENT) {
+            continue;
+        }
+        document_external_ids_[new_id] = document_external_ids_[internal_id];
+        document_ratings_[new_id] = document_ratings_[internal_id];
+        document_statuses_[new_id] = document_statuses_[internal_id];
+        document_inv_word_counts_[new_id] = document_inv_word_counts_[internal_id];
+        document_word_counts_[new_id] = document_word_counts_[internal_id];
+        document_terms_[new_id] = move(document_terms_[internal_id]);
+    }
+    const auto shrink = [live_count](auto& column) {
+        column.resize(live_count);
+        column.shrink_to_fit();
+    };
+    shrink(document_external_ids_);
+    shrink(document_ratings_);
+    shrink(document_statuses_);
+    shrink(document_inv_word_counts_);
+    shrink(document_word_counts_);
+    shrink(document_terms_);
+    document_is_removed_.assign(live_count, false);
+    document_is_removed_.shrink_to_fit();
+    for (auto& [_, internal_id] : document_ids_) {
+        internal_id = new_ids[internal_id];
+    }
+
+    // Текст освобожденного слова мог быть выдан MatchDocument и GetWordFrequencies, поэтому
+    // место под него переиспользуется только при уплотнении
+    terms_.ReclaimReleasedText();
+
+    // Сменились внутренние id и списки вхождений
+    ++generation_;
+}
+
+// Возвращает уровень сегмента, соответствующий кол-ву документов в нем
+int SearchServer::ComputeSegmentLevel(size_t document_count) {
+    int level = 0;
+    for (size_t size = WRITE_SEGMENT_SIZE * MERGE_FACTOR; size <= document_count; size *= MERGE_FACTOR) {
+        ++level;
+    }
+    return level;
+}
+
+// Возвращает слова документа с кол-вом повторений по возрастанию id слова
+vector<SearchServer::TermCount> SearchServer::GetDocumentTerms(int internal_id) const {
+    const auto& encoded_terms = document_terms_[internal_id];
+    vector<TermCount> term_counts;
+    int term_id = 0;
+    for (const uint8_t* data = encoded_terms.data(); data != encoded_terms.data() + encoded_terms.size();) {
+        term_id += static_cast<int>(ReadVarint(data));
+        term_counts.push_back({ term_id, static_cast<int>(ReadVarint(data)) });
+    }
+    return term_counts;
+}
+
+// Возвращает true, если слово есть среди слов документа
+bool SearchServer::HasTerm(const vector<TermCount>& term_counts, int term_id) {
+    const auto it = lower_bound(term_counts.begin(), term_counts.end(), term_id,
+        [](const TermCount& term_count, int id) {
+            return term_count.term_id < id;
+        });
+    return it != term_counts.end() && it->term_id == term_id;
 }
 
 // Расчитывает средний рейтинг
@@ -233,6 +1050,11 @@ int SearchServer::ComputeAverageRating(const vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
+// Возвращает внутренний id документа по внешнему, бросает out_of_range при его отсутствии
+int SearchServer::GetInternalId(int document_id) const {
+    return document_ids_.at(document_id);
+}
+
 // Присваивает слову статус минус или плюс слова
 SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
     if (word.empty()) {
@@ -248,39 +1070,320 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const {
         throw invalid_argument("Query word "s + string{ word } + " is invalid");
     }
 
-    return {word, is_minus, IsStopWord(word) };
+    return { terms_.Find(word), is_minus };
 }
 
-// Возвращает структуру с словарями плюс и минус слов
-SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sorting) const {
-    Query result;
+// Записывает в result id плюс и минус слов, память result переиспользуется
+void SearchServer::ParseQuery(string_view text, Query& result, bool skip_sorting) const {
+    result.plus_terms.clear();
+    result.minus_terms.clear();
 
-    for (string_view word : SplitIntoWords(text)) {
+    ForEachWord(text, [&](string_view word) {
         const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
+
+        // Слова, которых нет в словаре, не встречаются ни в одном документе
+        if (query_word.term.id != TermDictionary::NO_TERM && !query_word.term.is_stop) {
             if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
+                result.minus_terms.push_back(query_word.term.id);
             }
             else {
-                result.plus_words.push_back(query_word.data);
+                result.plus_terms.push_back(query_word.term.id);
             }
         }
-    }
+        });
 
     if (!skip_sorting) {
-        sort(result.plus_words.begin(), result.plus_words.end());
-        sort(result.minus_words.begin(), result.minus_words.end());
+        sort(result.plus_terms.begin(), result.plus_terms.end());
+        sort(result.minus_terms.begin(), result.minus_terms.end());
 
-        auto last = unique(result.minus_words.begin(), result.minus_words.end());
-        result.minus_words.erase(last, result.minus_words.end());
-        last = unique(result.plus_words.begin(), result.plus_words.end());
-        result.plus_words.erase(last, result.plus_words.end());
+        auto last = unique(result.minus_terms.begin(), result.minus_terms.end());
+        result.minus_terms.erase(last, result.minus_terms.end());
+        last = unique(result.plus_terms.begin(), result.plus_terms.end());
+        result.plus_terms.erase(last, result.plus_terms.end());
     }
+}
 
-    return result;
+// Записывает в query слова без стоп-слов, найденные в словаре, в виде id
+void SearchServer::LookupQueryWords(const vector<string>& plus_words,
+    const vector<string>& minus_words, Query& query) const {
+    const auto lookup = [this](const vector<string>& words, vector<int>& term_ids) {
+        term_ids.clear();
+        for (const string& word : words) {
+            const auto term = terms_.Find(word);
+            if (term.id != TermDictionary::NO_TERM && !term.is_stop) {
+                term_ids.push_back(term.id);
+            }
+        }
+        // Слова различны, поэтому различны и их id
+        sort(term_ids.begin(), term_ids.end());
+    };
+    lookup(plus_words, query.plus_terms);
+    lookup(minus_words, query.minus_terms);
+}
+
+// Возвращает статистику индекса для модели ранжирования. Кол-ва документов со словами
+// и сумма длин документов поддерживаются при изменениях, а не считаются при поиске
+CorpusStatistics SearchServer::GetCorpusStatistics() const {
+    CorpusStatistics statistics;
+    statistics.document_count = GetDocumentCount();
+    statistics.average_document_length = statistics.document_count > 0
+        ? static_cast<double>(total_word_count_) / statistics.document_count : 0.0;
+    statistics.document_lengths = document_word_counts_.data();
+    statistics.inv_document_lengths = document_inv_word_counts_.data();
+    return statistics;
+}
+
+// Записывает в resolved списки вхождений и веса слов запроса. Плюс-слова упорядочиваются
+// по убыванию оценки вклада, в этом порядке складывается релевантность при любой политике исполнения
+void SearchServer::ResolveQuery(const Query& query, ResolvedQuery& resolved) const {
+    resolved.plus_terms.clear();
+    resolved.minus_terms.clear();
+    visit([&](const auto& scoring_model) {
+        const auto ranker = scoring_model.Prepare(GetCorpusStatistics());
+        for (int term_id : query.plus_terms) {
+            if (term_document_counts_[term_id] > 0) {
+                TermPostings postings = GetTermPostings(term_id);
+                const double weight = ranker.ComputeTermWeight(term_document_counts_[term_id]);
+                const double max_score = ranker.ComputeMaxTermScore(postings.GetMaxTermFreq()) * weight;
+                resolved.plus_terms.push_back({ move(postings), weight, max_score, term_id });
+            }
+        }
+        resolved.ranker = ranker;
+    }, scoring_model_);
+
+    // Устойчивая сортировка вставками: слов в запросе немного, а stable_sort выделял бы
+    // временный буфер при каждом запросе
+    auto& plus_terms = resolved.plus_terms;
+    for (auto it = plus_terms.begin(); it != plus_terms.end(); ++it) {
+        const auto position = upper_bound(plus_terms.begin(), it, *it,
+            [](const ScoredTerm& lhs, const ScoredTerm& rhs) {
+                return lhs.max_score > rhs.max_score;
+            });
+        rotate(position, it, next(it));
+    }
+
+    for (int term_id : query.minus_terms) {
+        resolved.minus_terms.push_back(GetTermPostings(term_id));
+    }
+}
+
+// Разбирает запросы пакета и группирует их по словам. Слова всех запросов ищутся в индексе
+// как один запрос: порядок плюс-слов по убыванию оценки вклада (при равных оценках -
+// по возрастанию id) в пределах каждого запроса совпадает с порядком при поиске по нему одному,
+// поэтому релевантность складывается в том же порядке и получается той же
+SearchServer::QueryBatch SearchServer::PrepareQueryBatch(const vector<string>& raw_queries) const {
+    QueryBatch batch;
+    batch.query_count = raw_queries.size();
+
+    vector<Query> queries(raw_queries.size());
+    Query batch_query;
+    for (size_t query = 0; query < raw_queries.size(); ++query) {
+        ParseQuery(raw_queries[query], queries[query]);
+        batch_query.plus_terms.insert(batch_query.plus_terms.end(),
+            queries[query].plus_terms.begin(), queries[query].plus_terms.end());
+        batch_query.minus_terms.insert(batch_query.minus_terms.end(),
+            queries[query].minus_terms.begin(), queries[query].minus_terms.end());
+    }
+    for (vector<int>* term_ids : { &batch_query.plus_terms, &batch_query.minus_terms }) {
+        sort(term_ids->begin(), term_ids->end());
+        term_ids->erase(unique(term_ids->begin(), term_ids->end()), term_ids->end());
+    }
+    ResolveQuery(batch_query, batch.resolved);
+
+    // Индекс - позиция слова в batch_query, значение - номер слова в batch.resolved
+    // либо -1, если слова нет ни в одном документе
+    vector<int> plus_positions(batch_query.plus_terms.size(), -1);
+    for (size_t i = 0; i < batch.resolved.plus_terms.size(); ++i) {
+        const auto it = lower_bound(batch_query.plus_terms.begin(), batch_query.plus_terms.end(),
+            batch.resolved.plus_terms[i].term_id);
+        plus_positions[it - batch_query.plus_terms.begin()] = static_cast<int>(i);
+    }
+    vector<int> minus_positions(batch_query.minus_terms.size());
+    iota(minus_positions.begin(), minus_positions.end(), 0);
+
+    // Запросы раскладываются по словам подсчетом: сначала кол-ва запросов слов, затем номера
+    const auto group_queries = [&queries](vector<int> Query::* query_terms, const vector<int>& batch_terms,
+        const vector<int>& positions, size_t term_count, vector<size_t>& offsets, vector<int>& query_ids) {
+        const auto for_each_position = [&](auto function) {
+            for (size_t query = 0; query < queries.size(); ++query) {
+                for (int term_id : queries[query].*query_terms) {
+                    const auto it = lower_bound(batch_terms.begin(), batch_terms.end(), term_id);
+                    const int position = positions[it - batch_terms.begin()];
+                    if (position >= 0) {
+                        function(static_cast<int>(query), position);
+                    }
+                }
+            }
+        };
+
+        offsets.assign(term_count + 1, 0);
+        for_each_position([&](int, int position) {
+            ++offsets[position + 1];
+        });
+        partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        query_ids.resize(offsets.back());
+        vector<size_t> next_offsets(offsets.begin(), offsets.end() - 1);
+        for_each_position([&](int query, int position) {
+            query_ids[next_offsets[position]++] = query;
+        });
+    };
+    group_queries(&Query::plus_terms, batch_query.plus_terms, plus_positions, batch.resolved.plus_terms.size(),
+        batch.plus_offsets, batch.plus_queries);
+    group_queries(&Query::minus_terms, batch_query.minus_terms, minus_positions,
+        batch.resolved.minus_terms.size(), batch.minus_offsets, batch.minus_queries);
+    return batch;
+}
+
+// Передает в top_documents[q] найденные q-м запросом пакета документы с заданным статусом
+// и внутренними id из [begin, end). Id проходятся окнами, накопители которых занимают не более
+// BATCH_ACCUMULATOR_SIZE ячеек. В окне список вхождений каждого слова проходится один раз,
+// а вклад вхождения прибавляется к накопителям всех запросов со словом. Ячейки одного документа
+// для всех запросов лежат рядом, а накопители окна помещаются в кэш процессора.
+// Если бюджет исчерпан, в выдачи передается накопленное в текущем окне, и следующие окна
+// не обходятся
+template <typename Ranker>
+void SearchServer::FindBatchDocuments(const QueryBatch& batch, const Ranker& ranker, DocumentStatus status,
+    int begin, int end, vector<TopDocuments>& top_documents, BudgetMeter* budget) const {
+    const size_t query_count = batch.query_count;
+    if (query_count == 0 || begin >= end) {
+        return;
+    }
+    const int window_size = static_cast<int>(min<size_t>(end - begin,
+        max<size_t>(BATCH_ACCUMULATOR_SIZE / query_count, 1)));
+
+    vector<double> relevances(static_cast<size_t>(window_size) * query_count, 0.0);
+    vector<char> states(relevances.size(), UNSEEN);
+    vector<char> is_allowed(window_size);
+    vector<vector<int>> accepted_ids(query_count);
+    vector<int> accepted_queries; // Запросы, нашедшие документы в окне
+    vector<size_t> rejected_cells;
+
+    // Релевантность, ниже которой документ не попадет в заполненную выдачу запроса.
+    // Компактный массив порогов избавляет от обращения к куче выдачи за каждым документом
+    vector<double> thresholds(query_count, -numeric_limits<double>::infinity());
+
+    // Бюджет списывается блоками по BLOCK_SIZE пройденных вхождений плюс-слов
+    size_t unspent_postings = 0;
+    bool is_stopped = false;
+
+    for (int window_begin = begin, window_end = 0; !is_stopped && window_begin < end;
+        window_begin = window_end) {
+        window_end = window_begin + min(window_size, end - window_begin);
+        for (int internal_id = window_begin; internal_id < window_end; ++internal_id) {
+            is_allowed[internal_id - window_begin] = !document_is_removed_[internal_id]
+                && document_statuses_[internal_id] == status;
+        }
+
+        for (size_t i = 0; i < batch.resolved.minus_terms.size(); ++i) {
+            TermPostings::Cursor cursor = batch.resolved.minus_terms[i].GetCursor();
+            for (cursor.Advance(window_begin); cursor.GetDocumentId() < window_end; cursor.Next()) {
+                const size_t row = static_cast<size_t>(cursor.GetDocumentId() - window_begin) * query_count;
+                for (size_t j = batch.minus_offsets[i]; j < batch.minus_offsets[i + 1]; ++j) {
+                    const size_t cell = row + batch.minus_queries[j];
+                    if (states[cell] == UNSEEN) {
+                        states[cell] = REJECTED;
+                        rejected_cells.push_back(cell);
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; !is_stopped && i < batch.resolved.plus_terms.size(); ++i) {
+            const ScoredTerm& term = batch.resolved.plus_terms[i];
+            TermPostings::Cursor cursor = term.postings.GetCursor();
+            for (cursor.Advance(window_begin); cursor.GetDocumentId() < window_end; cursor.Next()) {
+                if (budget != nullptr && ++unspent_postings == PostingList::BLOCK_SIZE) {
+                    unspent_postings = 0;
+                    if (!budget->Spend(PostingList::BLOCK_SIZE)) {
+                        is_stopped = true;
+                        break;
+                    }
+                }
+                const int internal_id = cursor.GetDocumentId();
+                if (!is_allowed[internal_id - window_begin]) {
+                    continue;
+                }
+                const double score = ranker.ComputeTermScore(internal_id, cursor.GetCount()) * term.weight;
+                const size_t row = static_cast<size_t>(internal_id - window_begin) * query_count;
+                for (size_t j = batch.plus_offsets[i]; j < batch.plus_offsets[i + 1]; ++j) {
+                    const int query = batch.plus_queries[j];
+                    char& state = states[row + query];
+                    if (state == UNSEEN) {
+                        state = ACCEPTED;
+                        if (accepted_ids[query].empty()) {
+                            accepted_queries.push_back(query);
+                        }
+                        accepted_ids[query].push_back(internal_id);
+                    }
+                    if (state == ACCEPTED) {
+                        relevances[row + query] += score;
+                    }
+                }
+            }
+        }
+
+        // Найденные документы окна передаются в выдачи, а их ячейки сбрасываются для следующего окна
+        for (int query : accepted_queries) {
+            TopDocuments& query_top_documents = top_documents[query];
+            for (int internal_id : accepted_ids[query]) {
+                const size_t cell = static_cast<size_t>(internal_id - window_begin) * query_count + query;
+                if (relevances[cell] >= thresholds[query]) {
+                    query_top_documents.Add({ document_external_ids_[internal_id], relevances[cell],
+                        document_ratings_[internal_id] });
+                }
+                relevances[cell] = 0.0;
+                states[cell] = UNSEEN;
+            }
+            accepted_ids[query].clear();
+            // Документ с релевантностью ниже худшего отобранного больше чем на точность
+            // сравнения не вытеснит его и при большем рейтинге
+            if (query_top_documents.IsFull() && query_top_documents.GetMaxCount() > 0) {
+                thresholds[query] = query_top_documents.GetWorst().relevance - DOUBLE_ACCURACY;
+            }
+        }
+        accepted_queries.clear();
+        for (size_t cell : rejected_cells) {
+            states[cell] = UNSEEN;
+        }
+        rejected_cells.clear();
+    }
+}
+
+// Возвращает рабочую память поиска текущего потока
+SearchServer::QueryScratch& SearchServer::GetThreadQueryScratch() {
+    thread_local QueryScratch scratch;
+    return scratch;
+}
+
+// Возвращает рабочую память задач параллельного поиска текущего потока
+SearchServer::ChunkScratch& SearchServer::GetThreadChunkScratch() {
+    thread_local ChunkScratch scratch;
+    return scratch;
+}
+
+SearchServer::InstanceEpoch::InstanceEpoch()
+    : value_(Next()) {
+}
+
+// Перемещенный сервер - другой экземпляр, а источник остается без своего индекса
+SearchServer::InstanceEpoch::InstanceEpoch(InstanceEpoch&& other) noexcept
+    : value_(Next()) {
+    other.value_ = Next();
+}
+
+SearchServer::InstanceEpoch& SearchServer::InstanceEpoch::operator=(InstanceEpoch&& other) noexcept {
+    value_ = Next();
+    other.value_ = Next();
+    return *this;
+}
+
+uint64_t SearchServer::InstanceEpoch::Get() const {
+    return value_;
 }
 
-// Возвращает IDF
-double SearchServer::ComputeWordInverseDocumentFreq(string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+// Возвращает следующий номер из общего для процесса счетчика
+uint64_t SearchServer::InstanceEpoch::Next() {
+    static atomic<uint64_t> counter = 0;
+    return counter.fetch_add(1, memory_order_relaxed) + 1;
 }
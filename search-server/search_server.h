@@ -2,30 +2,87 @@
 
 #include <algorithm>
 #include <cmath>
-#include <deque>
+#include <cstdint>
 #include <execution>
+#include <future>
+#include <iterator>
+#include <limits>
 #include <map>
-#include <set>
+#include <memory>
+#include <numeric>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 #include <vector>
 
-#include "concurrent_map.h"
 #include "document.h"
+#include "posting_list.h"
+#include "query_cache.h"
+#include "scoring.h"
+#include "search_budget.h"
+#include "segment.h"
 #include "string_processing.h"
 #include "log_duration.h"
+#include "mapped_file.h"
+#include "mutation_log.h"
+#include "term_dictionary.h"
+#include "top_documents.h"
+#include "varint.h"
 
-const int MAX_RESULT_DOCUMENT_COUNT = 5;
-const double DOUBLE_ACCURACY = 1e-6; // Точность сравнения десятичных дробей
+const size_t MAX_RESULT_DOCUMENT_COUNT = 5; // Кол-во документов в выдаче по умолчанию
 
 class SearchServer {
 public:
     // Сокращенное наименование кортежа с результатом поиска метода MatchResult
     using MatchResult = std::tuple<std::vector<std::string_view>, DocumentStatus>;
 
+    // Итератор по внешним id документов сервера в порядке их возрастания
+    class DocumentIdIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int*;
+        using reference = const int&;
+
+        explicit DocumentIdIterator(std::map<int, int>::const_iterator it)
+            : it_(it) {}
+
+        reference operator*() const {
+            return it_->first;
+        }
+
+        pointer operator->() const {
+            return &it_->first;
+        }
+
+        DocumentIdIterator& operator++() {
+            ++it_;
+            return *this;
+        }
+
+        DocumentIdIterator operator++(int) {
+            DocumentIdIterator previous = *this;
+            ++it_;
+            return previous;
+        }
+
+        bool operator==(const DocumentIdIterator& other) const {
+            return it_ == other.it_;
+        }
+
+        bool operator!=(const DocumentIdIterator& other) const {
+            return it_ != other.it_;
+        }
+
+    private:
+        std::map<int, int>::const_iterator it_;
+    };
+
     // Конструктор преобразует строку const std::string& в контейнер и вызывает шаблонный контруктор
     explicit SearchServer(const std::string& stop_words_text);
 
@@ -40,13 +97,19 @@ public:
     void AddDocument(int document_id, std::string_view document, DocumentStatus status,
         const std::vector<int>& ratings);
 
-    // Шаблонный метод ищет документы по предикату
+    // Добавляет документы пакетом: разбор текста и построение вхождений идут параллельно.
+    // Результат тот же, что у AddDocument для каждого документа по порядку: при ошибке документы
+    // до ошибочного остаются добавленными и бросается то же исключение
+    void AddDocuments(const std::vector<NewDocument>& documents);
+
+    // Шаблонный метод ищет документы по предикату, возвращает не более max_count лучших
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    // Поиск документов с заданным статусом
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    // Поиск документов с заданным статусом, возвращает не более max_count лучших
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     // Поиск документов по умолчанию (только актуальные)
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
@@ -54,26 +117,133 @@ public:
     // Шаблонный метод ищет документы по предикату с заданной политикой исполнения
     template <typename DocumentPredicate, typename Policy>
     std::vector<Document> FindTopDocuments(const Policy policy, std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по предикату с ключом: при включенном кэше запросов выдача сохраняется под ключом
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindTopDocuments(const Policy policy, std::string_view raw_query,
+        const CachedPredicate<DocumentPredicate>& document_predicate,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     // Поиск документов с заданным статусом с заданной политикой исполнения
     template <typename Policy>
-    std::vector<Document> FindTopDocuments(const Policy policy, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const Policy policy, std::string_view raw_query, DocumentStatus status,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     // Поиск документов по умолчанию (только актуальные) с заданной политикой исполнения
     template <typename Policy>
     std::vector<Document> FindTopDocuments(const Policy policy, std::string_view raw_query) const;
 
+    // Поиск документов с заданным статусом в пределах бюджета времени и работы. Бюджет проверяется
+    // перед каждым блоком списка вхождений; когда он исчерпан, поиск прекращается и возвращает
+    // лучшие из найденных документов с флагом is_partial. Такой поиск не использует кэш запросов
+    SearchResult FindTopDocuments(std::string_view raw_query, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск документов по предикату в пределах бюджета
+    template <typename DocumentPredicate>
+    SearchResult FindTopDocuments(std::string_view raw_query, const SearchBudget& budget,
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск документов по предикату в пределах бюджета с заданной политикой исполнения
+    template <typename DocumentPredicate, typename Policy>
+    SearchResult FindTopDocuments(const Policy policy, std::string_view raw_query, const SearchBudget& budget,
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск документов с заданным статусом в пределах бюджета с заданной политикой исполнения
+    template <typename Policy>
+    SearchResult FindTopDocuments(const Policy policy, std::string_view raw_query, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Запрос, разобранный один раз для многократного поиска, см. PrepareQuery
+    class PreparedQuery;
+
+    // Разбирает и проверяет запрос, находит списки вхождений и IDF его слов. Бросает те же
+    // исключения, что и FindTopDocuments для этого запроса
+    PreparedQuery PrepareQuery(std::string_view raw_query) const;
+
+    // Поиск по подготовленному запросу по предикату с заданной политикой исполнения
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindTopDocuments(const Policy policy, const PreparedQuery& query,
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу по предикату с ключом кэша запросов
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindTopDocuments(const Policy policy, const PreparedQuery& query,
+        const CachedPredicate<DocumentPredicate>& document_predicate,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу документов с заданным статусом
+    template <typename Policy>
+    std::vector<Document> FindTopDocuments(const Policy policy, const PreparedQuery& query,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу документов с заданным статусом (по умолчанию актуальных)
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу документов с заданным статусом в пределах бюджета
+    SearchResult FindTopDocuments(const PreparedQuery& query, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу по предикату в пределах бюджета с заданной политикой исполнения
+    template <typename DocumentPredicate, typename Policy>
+    SearchResult FindTopDocuments(const Policy policy, const PreparedQuery& query, const SearchBudget& budget,
+        DocumentPredicate document_predicate, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по подготовленному запросу документов с заданным статусом в пределах бюджета
+    // с заданной политикой исполнения
+    template <typename Policy>
+    SearchResult FindTopDocuments(const Policy policy, const PreparedQuery& query, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов документов с заданным статусом. Выдачи идут в порядке запросов
+    // и совпадают с выдачами FindTopDocuments. Запросы группируются по словам: список вхождений
+    // каждого слова проходится один раз для всего пакета, и вклад вхождения раздается всем
+    // запросам с этим словом. Выгоден для больших пакетов запросов с общими словами
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов с заданной политикой исполнения (последовательной)
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::execution::sequenced_policy&,
+        const std::vector<std::string>& raw_queries, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов с заданной политикой исполнения (параллельной):
+    // диапазоны id документов обрабатываются параллельно
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::execution::parallel_policy&,
+        const std::vector<std::string>& raw_queries, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов в пределах общего бюджета: пакет проходится одним поиском, поэтому
+    // и search_timeout отсчитывается от его начала. Когда бюджет исчерпан, выдачи всех запросов
+    // составляются из документов, найденных к этому моменту, и помечаются is_partial
+    std::vector<SearchResult> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+        const SearchBudget& budget, DocumentStatus status = DocumentStatus::ACTUAL,
+        size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов в пределах бюджета с заданной политикой исполнения (последовательной)
+    std::vector<SearchResult> FindTopDocumentsBatch(const std::execution::sequenced_policy&,
+        const std::vector<std::string>& raw_queries, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Поиск по пакету запросов в пределах бюджета с заданной политикой исполнения (параллельной)
+    std::vector<SearchResult> FindTopDocumentsBatch(const std::execution::parallel_policy&,
+        const std::vector<std::string>& raw_queries, const SearchBudget& budget,
+        DocumentStatus status = DocumentStatus::ACTUAL, size_t max_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
     // Возвращает кол-во документов
     int GetDocumentCount() const;
 
-    // Возвращает итератор на начало document_ids_
-    std::set<int>::iterator begin();
+    // Возвращает итератор на первый id документа
+    DocumentIdIterator begin() const;
 
-    // Возвращает итератор на конец document_ids_
-    std::set<int>::iterator end();
+    // Возвращает итератор на конец последовательности id документов
+    DocumentIdIterator end() const;
 
-    // Сверяет запрос с конкретным документом, возвращает совпавшие слова и статус документа
+    // Сверяет запрос с конкретным документом, возвращает совпавшие слова и статус документа.
+    // Совпавшие слова указывают в словарь сервера. Слово, которого не осталось ни в одном
+    // документе, действительно до ближайшего уплотнения индекса (см. RemoveDocument)
     MatchResult MatchDocument(std::string_view raw_query,
         int document_id) const;
 
@@ -87,10 +257,16 @@ public:
     MatchResult MatchDocument(const std::execution::parallel_policy&,
         std::string_view raw_query, int document_id) const;
 
-    // Возвращает частоту слов в документе по его id
-    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+    // Возвращает частоту слов в документе по его id. Слова указывают в словарь сервера
+    // и действительны так же, как у MatchDocument
+    std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
 
-    // Удаление документа по его id
+    // Удаление документа по его id. Когда удаленных документов накапливается не меньше, чем
+    // действующих, удаление уплотняет индекс: оставшиеся документы получают внутренние id подряд,
+    // а строки и вхождения удаленных освобождаются. Уплотнение проходит весь индекс, но случается
+    // не чаще, чем через столько удалений, сколько в индексе действующих документов.
+    // Оно же отдает новым словам текст слов, не оставшихся ни в одном документе: string_view
+    // таких слов из MatchDocument и GetWordFrequencies после него недействительны
     void RemoveDocument(int document_id);
 
     // Удаление документа по его id по заданной политике выполнения - последовательной
@@ -99,144 +275,527 @@ public:
     // Удаление документа по его id по заданной политике выполнения - параллельной
     void RemoveDocument(const std::execution::parallel_policy&, int document_id);
 
+    // Задает модель ранжирования документов: TfIdfScorer (по умолчанию) или Bm25Scorer
+    void SetScoringModel(ScoringModel scoring_model);
+
+    // Включает кэш выдач поиска по статусу и по предикатам с ключом на capacity запросов,
+    // 0 отключает кэш. Любое изменение документов делает сохраненные выдачи недействительными
+    void EnableQueryCache(size_t capacity);
+
+    // Возвращает кол-во попаданий и промахов кэша запросов
+    QueryCache::Statistics GetQueryCacheStatistics() const;
+
+    // Дожидается фоновых слияний сегментов, пока политика слияния их требует
+    void WaitForMerges();
+
+    // Сохраняет стоп-слова, словарь, списки вхождений, слова и данные документов в двоичный снимок.
+    // Снимок пишется во временный файл, который затем заменяет path. Бросает runtime_error
+    void SaveSnapshot(const std::string& path) const;
+
+    // Загружает сервер из снимка. Файл отображается в память: списки вхождений и текст слов
+    // читаются прямо из него и копируются лишь при изменении. Бросает runtime_error, если файл
+    // не открывается, и invalid_argument, если он поврежден или другой версии.
+    // По умолчанию проверяется только структура снимка, и страницы списков вхождений читаются
+    // при первом обращении. SnapshotVerification::FULL сверяет и контрольную сумму, читая файл
+    // целиком; она нужна, если файл мог быть поврежден на носителе или при копировании
+    static SearchServer LoadSnapshot(const std::string& path,
+        SnapshotVerification verification = SnapshotVerification::STRUCTURE);
+
+    // Подключает журнал изменений: применяет записи журнала новее загруженного снимка, после чего
+    // добавление и удаление документов сначала записываются в журнал. nullptr отключает журнал.
+    // Журнал должен жить дольше сервера или до отключения. Бросает invalid_argument, если журнал
+    // очищен после снимка сервера (снимок старше последнего MutationLog::Truncate)
+    void AttachMutationLog(MutationLog* mutation_log);
+
+    // Возвращает номер последней записи журнала, учтенной в сервере. Сохраняется в снимке
+    uint64_t GetLogSequence() const;
+
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
+    // Повторяет изменения на второй версии индекса без повторной записи в журнал
+    friend class ConcurrentSearchServer;
+
+    // Отображенный снимок, из которого загружен сервер
+    std::unique_ptr<MappedFile> snapshot_file_;
+
+    // Журнал, в который записываются изменения, и номер последней учтенной записи
+    MutationLog* mutation_log_ = nullptr;
+    uint64_t log_sequence_ = 0;
+
+    // Словарь слов документов и стоп-слов
+    TermDictionary terms_;
+
+    // Номер экземпляра сервера, уникальный в пределах процесса. Создание сервера, в том числе
+    // загрузка снимка, и перемещение дают новые номера и сервер-источнику, и серверу-приемнику,
+    // поэтому подготовленный запрос не примет за свой сервер на том же адресе или с тем же поколением
+    class InstanceEpoch {
+    public:
+        InstanceEpoch();
+        InstanceEpoch(InstanceEpoch&& other) noexcept;
+        InstanceEpoch& operator=(InstanceEpoch&& other) noexcept;
+
+        uint64_t Get() const;
+
+    private:
+        uint64_t value_;
+
+        // Возвращает следующий номер из общего для процесса счетчика
+        static uint64_t Next();
     };
-    const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
+    InstanceEpoch epoch_;
+
+    // Поколение индекса, растет при каждом добавлении и удалении документов и при установке
+    // слияния сегментов. Выдачи в кэше и списки вхождений подготовленных запросов действительны
+    // в пределах поколения
+    uint64_t generation_ = 0;
+    std::unique_ptr<QueryCache> query_cache_;
+
+    ScoringModel scoring_model_;
+
+    // Индекс состоит из сегментов, каждый хранит вхождения слов для своего диапазона внутренних id.
+    // Новые документы попадают в пишущий сегмент, который по накоплении WRITE_SEGMENT_SIZE
+    // документов запечатывается. Запечатанные сегменты не меняются и в фоне сливаются по уровням:
+    // MERGE_FACTOR соседних сегментов уровня L дают сегмент уровня L + 1. Так добавление стоит
+    // одинаково при любом размере индекса, а число сегментов растет логарифмически
+    static const int WRITE_SEGMENT_SIZE = 8192;
+    static const size_t MERGE_FACTOR = 4;
+
+    // Сегмент, где удалено не меньше 1 / TOMBSTONE_MERGE_RATIO документов с вхождениями,
+    // переписывается без них, даже если сливать его не с чем
+    static const int TOMBSTONE_MERGE_RATIO = 4;
+
+    // Запечатанные сегменты по возрастанию id документов
+    std::vector<std::shared_ptr<const Segment>> segments_;
+
+    // Индекс - номер сегмента, значение - кол-во документов, удаленных после создания сегмента.
+    // Их вхождения еще лежат в сегменте
+    std::vector<int> segment_removed_counts_;
+
+    // Пишущий сегмент: индекс - id слова, значение - вхождения слова в документы
+    // начиная с write_first_document_id_
+    std::vector<PostingList> write_postings_;
+    std::vector<int> write_term_ids_; // Слова с непустыми списками пишущего сегмента
+    int write_first_document_id_ = 0;
+    int write_removed_count_ = 0; // Удаленные документы пишущего сегмента
+
+    // Фоновое слияние сегментов [merge_first_segment_, merge_first_segment_ + merge_segment_count_).
+    // merge_removed_count_ - удаленные документы этих сегментов на начало слияния, их вхождения
+    // слияние отбрасывает
+    std::future<std::shared_ptr<const Segment>> merge_result_;
+    size_t merge_first_segment_ = 0;
+    size_t merge_segment_count_ = 0;
+    int merge_removed_count_ = 0;
+
+    // Индекс - id слова, значение - кол-во действующих документов с ним. Из него считается IDF
+    std::vector<int> term_document_counts_;
 
-    // Дэк для хранения строк добавляемых документов
-    std::deque<std::string> document_;
+    // Ключ - внешний id документа, значение - внутренний.
+    // Внутренние id выдаются подряд начиная с нуля и служат индексами столбцов ниже.
+    // Уплотнение индекса (CompactDocuments) назначает действующим документам id заново
+    std::map<int, int> document_ids_;
 
-    // Ключ - int id
-    // Значение - map<string, double> (слово, частота в док-те)
-    std::map<int, std::map<std::string_view, double>> id_to_words_and_freqs_;
+    // Столбцы данных документов, индексируемые внутренним id.
+    // Строки удаленных документов остаются в столбцах до уплотнения индекса
+    std::vector<int> document_external_ids_;
+    std::vector<int> document_ratings_;
+    std::vector<DocumentStatus> document_statuses_;
 
-    // Возвращает true, если строка является стоп-словом
-    bool IsStopWord(std::string_view word) const;
+    // 1 / кол-во слов документа без стоп-слов. Частота слова - кол-во его повторений на это число
+    std::vector<double> document_inv_word_counts_;
+
+    // Кол-во слов документа без стоп-слов и их сумма по действующим документам
+    std::vector<int> document_word_counts_;
+    uint64_t total_word_count_ = 0;
+
+    // Признаки удаления (tombstone). Вхождения удаленного документа остаются в сегментах
+    // до их слияния или уплотнения индекса и пропускаются при поиске
+    std::vector<char> document_is_removed_;
+
+    struct TermCount {
+        int term_id;
+        int count;
+    };
+
+    // Индекс - внутренний id документа
+    // Значение - слова документа по возрастанию id: пары (разность id слова с предыдущим, кол-во
+    // повторений), записанные кодом varint
+    std::vector<std::vector<uint8_t>> document_terms_;
 
     // Возвращает true, если строка не содержит спец-символы
     static bool IsValidWord(std::string_view word);
 
-    // Возвращает вектор строк без стоп-слов
-    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+    // Пустой сервер для загрузки снимка
+    SearchServer() = default;
+
+    // Возвращает слова документа с кол-вом повторений по возрастанию id слова
+    std::vector<TermCount> GetDocumentTerms(int internal_id) const;
+
+    // Уменьшает счетчики документов слов удаляемого документа, освобождает слова, которых
+    // не осталось ни в одном документе, и память под список слов документа
+    void ReleaseDocumentTerms(int internal_id, const std::vector<TermCount>& term_counts);
+
+    // Возвращает true, если слово есть среди слов документа
+    static bool HasTerm(const std::vector<TermCount>& term_counts, int term_id);
+
+    // Кол-во документов в части, на которые AddDocuments делит пакет
+    static const size_t ADD_BATCH_PART_SIZE = 4096;
+
+    // Добавляет документы до первого, на котором AddDocument бросил бы исключение,
+    // и возвращает их кол-во
+    size_t AddValidDocuments(std::vector<NewDocument>::const_iterator first,
+        std::vector<NewDocument>::const_iterator last);
+
+    // Слова документа, подготовленные к записи в индекс
+    struct DocumentTerms {
+        std::vector<TermCount> term_counts; // По возрастанию id слова
+        std::vector<uint8_t> encoded_terms; // term_counts в формате document_terms_
+        int word_count = 0;
+        double inv_word_count = 0.0;
+    };
+
+    // Считает повторения слов документа по их id, стоп-слова уже исключены
+    static DocumentTerms CountDocumentTerms(std::vector<int> term_ids);
+
+    // Заносит документ в столбцы и список id, возвращает его внутренний id.
+    // Вхождения слов в пишущий сегмент добавляет вызывающий
+    int AppendDocumentRow(int document_id, DocumentStatus status, const std::vector<int>& ratings,
+        DocumentTerms& terms);
+
+    // Расширяет столбцы по id слова до размера словаря
+    void ResizeTermColumns();
+
+    // Возвращает вхождения слова во всех сегментах
+    TermPostings GetTermPostings(int term_id) const;
+
+    // Запечатывает пишущий сегмент, если в нем накопилось WRITE_SEGMENT_SIZE документов
+    void SealWriteSegment();
+
+    // Переносит вхождения пишущего сегмента в запечатанный сегмент уровня 0 и начинает новый
+    // пишущий сегмент
+    std::shared_ptr<const Segment> ExtractWriteSegment();
+
+    // Устанавливает завершившееся фоновое слияние и запускает следующее, если оно нужно
+    void PollMerge();
+
+    // Запускает фоновое слияние первых MERGE_FACTOR соседних сегментов одного уровня, а если
+    // таких нет - перезапись первого сегмента, где удалено много документов (TOMBSTONE_MERGE_RATIO).
+    // Ничего не делает, пока идет другое слияние
+    void StartMerge();
+
+    // Заменяет слитые сегменты результатом слияния
+    void InstallMerge();
+
+    // Уплотняет индекс: назначает действующим документам внутренние id подряд с сохранением
+    // порядка, переписывает все сегменты вместе с пишущим в один, удаляет из столбцов строки
+    // удаленных документов и освобождает текст освобожденных слов
+    void CompactDocuments();
+
+    // Возвращает уровень сегмента, соответствующий кол-ву документов в нем
+    static int ComputeSegmentLevel(size_t document_count);
 
     // Расчитывает средний рейтинг
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    // Возвращает внутренний id документа по внешнему, бросает out_of_range при его отсутствии
+    int GetInternalId(int document_id) const;
+
     struct QueryWord {
-        std::string_view data;
+        TermDictionary::Term term; // id NO_TERM, если слова нет в словаре
         bool is_minus;
-        bool is_stop;
     };
 
     // Присваивает слову статус минус или плюс слова
     QueryWord ParseQueryWord(std::string_view text) const;
 
+    // Слова запроса, встречающиеся в словаре, в виде id
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        std::vector<int> plus_terms;
+        std::vector<int> minus_terms;
     };
 
-    // Возвращает структуру с словарями плюс и минус слов
-    Query ParseQuery(std::string_view text, bool skip_sorting = false) const;
+    // Записывает в query id плюс и минус слов, память query переиспользуется
+    void ParseQuery(std::string_view text, Query& query, bool skip_sorting = false) const;
 
-    // Возвращает IDF
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    // Записывает в query слова без стоп-слов, найденные в словаре, в виде id
+    void LookupQueryWords(const std::vector<std::string>& plus_words,
+        const std::vector<std::string>& minus_words, Query& query) const;
 
-    // Возвращает вектор всех найденных по запросу документов без стоп и минус слов
-    // согласно условию функции-предиката
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query,
-        DocumentPredicate document_predicate) const;
+    // Возвращает статистику индекса для модели ранжирования
+    CorpusStatistics GetCorpusStatistics() const;
 
-    // Возвращает вектор всех найденных по запросу документов без стоп и минус слов
-    // согласно условию функции-предиката с последовательной политикой исполнения
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::sequenced_policy&,
-        const Query& query, DocumentPredicate document_predicate) const;
+    // Во сколько раз список вхождений должен быть длиннее списка кандидатов,
+    // чтобы искать кандидатов в нем с пропуском блоков, а не проходить его подряд
+    static const size_t SPARSE_CANDIDATES_RATIO = 8;
+
+    // Слово запроса, найденное в индексе, с верхней оценкой его вклада в релевантность
+    struct ScoredTerm {
+        TermPostings postings;
+        double weight;    // Вес слова в модели ранжирования, для TF-IDF - IDF
+        double max_score; // weight * верхняя оценка вхождения слова
+        int term_id;
+    };
+
+    // Слова запроса со списками вхождений
+    struct ResolvedQuery {
+        // Встречающиеся в документах плюс-слова по убыванию оценки вклада.
+        // В этом порядке складывается релевантность при любой политике исполнения
+        std::vector<ScoredTerm> plus_terms;
+        std::vector<TermPostings> minus_terms;
+
+        // Модель ранжирования, подготовленная по статистике индекса на момент поиска слов
+        ScoringRanker ranker;
+    };
+
+    // Записывает в resolved списки вхождений и веса слов запроса, память resolved переиспользуется
+    void ResolveQuery(const Query& query, ResolvedQuery& resolved) const;
+
+    // Состояние документа при последовательном поиске
+    enum DocumentState : char {
+        UNSEEN,
+        ACCEPTED, // Удовлетворяет предикату, релевантность накапливается
+        REJECTED, // Не удовлетворяет предикату либо содержит минус-слово
+    };
+
+    // Рабочая память поиска. У каждого потока свой экземпляр, который переиспользуется
+    // его запросами, поэтому в установившемся режиме поиск выделяет память лишь под выдачу.
+    // Плотные массивы растут до числа документов самого большого индекса, где искал поток
+    struct QueryScratch {
+        Query query;
+        ResolvedQuery resolved;
+        TopDocuments top_documents{ 0 };
+
+        // Индекс - внутренний id документа. Между запросами сбрасываются только
+        // элементы документов из seen_ids
+        std::vector<double> relevances;
+        std::vector<char> states;
+        std::vector<int> seen_ids; // Документы, состояние которых изменил последний запрос
+
+        std::vector<int> accepted_ids;
+        std::vector<int> candidates;
+        std::vector<double> remaining_max_score;
+        std::vector<double> best_relevances;
+
+        // Выдачи участков при параллельном поиске
+        std::vector<size_t> chunks;
+        std::vector<std::vector<Document>> chunk_top_documents;
+
+        bool is_in_use = false;
+    };
+
+    // Рабочая память задачи параллельного поиска, своя у каждого потока
+    struct ChunkScratch {
+        std::vector<double> relevances;
+        std::vector<char> is_matched;
+        TopDocuments top_documents{ 0 };
+
+        bool is_in_use = false;
+    };
+
+    // Во сколько раз затронутых прошлым запросом документов должно быть меньше, чем элементов
+    // плотных массивов, чтобы сбрасывать только их
+    static const size_t DENSE_RESET_RATIO = 8;
+
+    // Возвращают рабочую память текущего потока
+    static QueryScratch& GetThreadQueryScratch();
+    static ChunkScratch& GetThreadChunkScratch();
+
+    // Занимает рабочую память потока на время поиска. Если она уже занята (предикат сам
+    // вызвал поиск в том же потоке), выделяется отдельный экземпляр
+    template <typename Scratch>
+    class ScratchLease {
+    public:
+        explicit ScratchLease(Scratch& thread_scratch) {
+            if (thread_scratch.is_in_use) {
+                owned_scratch_ = std::make_unique<Scratch>();
+                scratch_ = owned_scratch_.get();
+            }
+            else {
+                scratch_ = &thread_scratch;
+            }
+            scratch_->is_in_use = true;
+        }
+
+        ScratchLease(const ScratchLease&) = delete;
+        ScratchLease& operator=(const ScratchLease&) = delete;
+
+        ~ScratchLease() {
+            scratch_->is_in_use = false;
+        }
+
+        Scratch& operator*() const {
+            return *scratch_;
+        }
+
+        Scratch* operator->() const {
+            return scratch_;
+        }
+
+    private:
+        Scratch* scratch_;
+        std::unique_ptr<Scratch> owned_scratch_;
+    };
+
+    // Отбор документов для ключа кэша запросов
+    struct CacheTag {
+        int status = -1; // Статус документов либо -1 для предиката с ключом
+        std::string_view predicate_key;
+    };
+
+    // Возвращает предикат отбора документов с заданным статусом
+    static auto MakeStatusPredicate(DocumentStatus status) {
+        return [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        };
+    }
+
+    // Разбирает текст запроса в рабочей памяти потока и ищет документы по нему.
+    // budget - расход бюджета поиска либо nullptr, если поиск не ограничен
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindRawQueryTopDocuments(const Policy policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, const CacheTag* cache_tag, size_t max_count,
+        BudgetMeter* budget) const;
+
+    // Ищет документы по разобранному запросу. resolved - списки вхождений слов запроса,
+    // найденные заранее, либо nullptr. Если кэш запросов включен и cache_tag не nullptr,
+    // выдача сначала ищется в кэше и после поиска сохраняется в нем
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindQueryTopDocuments(const Policy policy, const Query& query,
+        const ResolvedQuery* resolved, DocumentPredicate document_predicate, const CacheTag* cache_tag,
+        size_t max_count, QueryScratch& scratch, BudgetMeter* budget) const;
+
+    // Ищет документы по подготовленному запросу. Если после подготовки индекс изменился
+    // или запрос подготовлен другим сервером, слова запроса заново ищутся в словаре.
+    // budget - расход бюджета поиска либо nullptr, если поиск не ограничен
+    template <typename DocumentPredicate, typename Policy>
+    std::vector<Document> FindPreparedTopDocuments(const Policy policy, const PreparedQuery& query,
+        DocumentPredicate document_predicate, const CacheTag* cache_tag, size_t max_count,
+        BudgetMeter* budget) const;
 
-    // Возвращает вектор всех найденных по запросу документов без стоп и минус слов
+    // Пакет запросов, сгруппированный по словам
+    struct QueryBatch {
+        size_t query_count = 0;
+
+        // Слова всех запросов пакета. Плюс-слова упорядочены по убыванию оценки вклада,
+        // и в пределах каждого запроса порядок тот же, что при поиске по нему одному
+        ResolvedQuery resolved;
+
+        // Номера запросов с плюс-словом resolved.plus_terms[i] по возрастанию:
+        // plus_queries[plus_offsets[i]], ..., plus_queries[plus_offsets[i + 1] - 1]
+        std::vector<size_t> plus_offsets;
+        std::vector<int> plus_queries;
+
+        // То же для минус-слов resolved.minus_terms
+        std::vector<size_t> minus_offsets;
+        std::vector<int> minus_queries;
+    };
+
+    // Наибольшее кол-во ячеек накопителей релевантности (документ, запрос), которые пакетный
+    // поиск держит одновременно в одном потоке. Id документов проходятся окнами такой ширины,
+    // чтобы накопители окна (около 2 МБ) помещались в кэш
+    static const size_t BATCH_ACCUMULATOR_SIZE = 1 << 18;
+
+    // Разбирает запросы пакета и группирует их по словам
+    QueryBatch PrepareQueryBatch(const std::vector<std::string>& raw_queries) const;
+
+    // Ищут документы по пакету запросов. budget - расход бюджета поиска либо nullptr
+    std::vector<std::vector<Document>> FindBatchTopDocuments(const std::execution::sequenced_policy&,
+        const std::vector<std::string>& raw_queries, DocumentStatus status, size_t max_count,
+        BudgetMeter* budget) const;
+    std::vector<std::vector<Document>> FindBatchTopDocuments(const std::execution::parallel_policy&,
+        const std::vector<std::string>& raw_queries, DocumentStatus status, size_t max_count,
+        BudgetMeter* budget) const;
+
+    // Ищет документы по пакету запросов в пределах бюджета
+    template <typename Policy>
+    std::vector<SearchResult> FindBudgetedBatchTopDocuments(const Policy policy,
+        const std::vector<std::string>& raw_queries, const SearchBudget& budget, DocumentStatus status,
+        size_t max_count) const;
+
+    // Передает в top_documents[q] найденные q-м запросом пакета документы с заданным статусом
+    // и внутренними id из [begin, end)
+    template <typename Ranker>
+    void FindBatchDocuments(const QueryBatch& batch, const Ranker& ranker, DocumentStatus status,
+        int begin, int end, std::vector<TopDocuments>& top_documents, BudgetMeter* budget) const;
+
+    // Передает в scratch.top_documents найденные по запросу документы без стоп и минус слов
+    // согласно условию функции-предиката с последовательной политикой исполнения.
+    // Документы, которые заведомо не войдут в выдачу, не оцениваются (алгоритм MaxScore)
+    template <typename Ranker, typename DocumentPredicate>
+    void FindAllDocuments(const std::execution::sequenced_policy&, const ResolvedQuery& query,
+        const Ranker& ranker, DocumentPredicate document_predicate, QueryScratch& scratch,
+        BudgetMeter* budget) const;
+
+    // Передает в scratch.top_documents все найденные по запросу документы без стоп и минус слов
     // согласно условию функции-предиката с параллельной политикой исполнения
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy&, 
-        const Query& query, DocumentPredicate document_predicate) const;
+    template <typename Ranker, typename DocumentPredicate>
+    void FindAllDocuments(const std::execution::parallel_policy&, const ResolvedQuery& query,
+        const Ranker& ranker, DocumentPredicate document_predicate, QueryScratch& scratch,
+        BudgetMeter* budget) const;
+};
+
+// Запрос, разобранный и проверенный один раз: хранит его слова без повторов и стоп-слов,
+// а также списки вхождений и IDF слов на момент подготовки. Поиск по нему не разбирает текст.
+// Запрос можно выполнять и после изменения индекса: тогда его слова заново ищутся в словаре
+class SearchServer::PreparedQuery {
+private:
+    friend class SearchServer;
+
+    std::vector<std::string> plus_words_;
+    std::vector<std::string> minus_words_;
+
+    // Номер экземпляра сервера и его поколение, для которых найдены query_ и resolved_.
+    // Номера экземпляров начинаются с единицы, так что неподготовленный запрос не подходит никому
+    uint64_t epoch_ = 0;
+    uint64_t generation_ = 0;
+    Query query_;
+    ResolvedQuery resolved_;
 };
 
 // Шаблонный контруктор проверяет и добавляет стоп-слова из шаблонного контейнера
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))  // Extract non-empty stop words
-{
+SearchServer::SearchServer(const StringContainer& stop_words) {
+    const auto unique_stop_words = MakeUniqueNonEmptyStrings(stop_words); // Extract non-empty stop words
+
     // Проверка слов на наличие спец-символов
-    if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
+    if (!all_of(unique_stop_words.begin(), unique_stop_words.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid");
     }
+    for (const std::string& word : unique_stop_words) {
+        terms_.AddStopWord(word);
+    }
+    ResizeTermColumns();
 }
 
-// Шаблонный метод ищет документы по предикату
+// Шаблонный метод ищет документы по предикату, возвращает не более max_count лучших
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
-    std::string string_raw_query{ raw_query };
-    const auto query = ParseQuery(string_raw_query);
-
-    auto matched_documents = FindAllDocuments(query, document_predicate);
-
-    sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < DOUBLE_ACCURACY) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-
-    return matched_documents;
+    DocumentPredicate document_predicate, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, max_count);
 }
 
 // Шаблонный метод ищет документы по предикату с заданной политикой исполнения
 template <typename DocumentPredicate, typename Policy>
 std::vector<Document> SearchServer::FindTopDocuments(const Policy policy,
-    std::string_view raw_query, DocumentPredicate document_predicate) const {
-    std::string string_raw_query{ raw_query };
-    const auto query = ParseQuery(string_raw_query);
-
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
-
-    sort(matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < DOUBLE_ACCURACY) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
+    std::string_view raw_query, DocumentPredicate document_predicate, size_t max_count) const {
+    return FindRawQueryTopDocuments(policy, raw_query, document_predicate, nullptr, max_count, nullptr);
+}
 
-    return matched_documents;
+// Поиск по предикату с ключом: при включенном кэше запросов выдача сохраняется под ключом
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy policy,
+    std::string_view raw_query, const CachedPredicate<DocumentPredicate>& document_predicate,
+    size_t max_count) const {
+    const CacheTag cache_tag{ -1, document_predicate.cache_key };
+    return FindRawQueryTopDocuments(policy, raw_query, document_predicate.predicate, &cache_tag, max_count,
+        nullptr);
 }
 
 // Поиск документов с заданным статусом с заданной политикой исполнения
 template <typename Policy>
 std::vector<Document> SearchServer::FindTopDocuments(const Policy policy,
-    std::string_view raw_query, DocumentStatus status) const {
-    return SearchServer::FindTopDocuments(policy,
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+    std::string_view raw_query, DocumentStatus status, size_t max_count) const {
+    const CacheTag cache_tag{ static_cast<int>(status), {} };
+    return FindRawQueryTopDocuments(policy, raw_query, MakeStatusPredicate(status), &cache_tag, max_count,
+        nullptr);
 }
 
 // Поиск документов по умолчанию (только актуальные) с заданной политикой исполнения
@@ -246,89 +805,435 @@ std::vector<Document> SearchServer::FindTopDocuments(const Policy policy,
     return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
 }
 
-// Возвращает вектор всех найденных по запросу документов без стоп и минус слов
-// согласно условию функции-предиката
+// Поиск документов по предикату в пределах бюджета
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
-    DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+SearchResult SearchServer::FindTopDocuments(std::string_view raw_query, const SearchBudget& budget,
+    DocumentPredicate document_predicate, size_t max_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, budget, document_predicate, max_count);
+}
+
+// Поиск документов по предикату в пределах бюджета с заданной политикой исполнения.
+// Частичная выдача зависит от момента остановки, поэтому кэш запросов не используется
+template <typename DocumentPredicate, typename Policy>
+SearchResult SearchServer::FindTopDocuments(const Policy policy, std::string_view raw_query,
+    const SearchBudget& budget, DocumentPredicate document_predicate, size_t max_count) const {
+    BudgetMeter meter(budget);
+    SearchResult result;
+    result.documents = FindRawQueryTopDocuments(policy, raw_query, document_predicate, nullptr, max_count,
+        &meter);
+    result.is_partial = meter.IsExhausted();
+    return result;
+}
+
+// Поиск документов с заданным статусом в пределах бюджета с заданной политикой исполнения
+template <typename Policy>
+SearchResult SearchServer::FindTopDocuments(const Policy policy, std::string_view raw_query,
+    const SearchBudget& budget, DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(policy, raw_query, budget, MakeStatusPredicate(status), max_count);
+}
+
+// Поиск по подготовленному запросу по предикату с заданной политикой исполнения
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy policy, const PreparedQuery& query,
+    DocumentPredicate document_predicate, size_t max_count) const {
+    return FindPreparedTopDocuments(policy, query, document_predicate, nullptr, max_count, nullptr);
+}
+
+// Поиск по подготовленному запросу по предикату с ключом кэша запросов
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy policy, const PreparedQuery& query,
+    const CachedPredicate<DocumentPredicate>& document_predicate, size_t max_count) const {
+    const CacheTag cache_tag{ -1, document_predicate.cache_key };
+    return FindPreparedTopDocuments(policy, query, document_predicate.predicate, &cache_tag, max_count,
+        nullptr);
+}
+
+// Поиск по подготовленному запросу документов с заданным статусом
+template <typename Policy>
+std::vector<Document> SearchServer::FindTopDocuments(const Policy policy, const PreparedQuery& query,
+    DocumentStatus status, size_t max_count) const {
+    const CacheTag cache_tag{ static_cast<int>(status), {} };
+    return FindPreparedTopDocuments(policy, query, MakeStatusPredicate(status), &cache_tag, max_count,
+        nullptr);
+}
+
+// Поиск по подготовленному запросу по предикату в пределах бюджета с заданной политикой исполнения
+template <typename DocumentPredicate, typename Policy>
+SearchResult SearchServer::FindTopDocuments(const Policy policy, const PreparedQuery& query,
+    const SearchBudget& budget, DocumentPredicate document_predicate, size_t max_count) const {
+    BudgetMeter meter(budget);
+    SearchResult result;
+    result.documents = FindPreparedTopDocuments(policy, query, document_predicate, nullptr, max_count, &meter);
+    result.is_partial = meter.IsExhausted();
+    return result;
+}
+
+// Поиск по подготовленному запросу документов с заданным статусом в пределах бюджета
+// с заданной политикой исполнения
+template <typename Policy>
+SearchResult SearchServer::FindTopDocuments(const Policy policy, const PreparedQuery& query,
+    const SearchBudget& budget, DocumentStatus status, size_t max_count) const {
+    return FindTopDocuments(policy, query, budget, MakeStatusPredicate(status), max_count);
+}
+
+// Разбирает текст запроса в рабочей памяти потока и ищет документы по нему
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindRawQueryTopDocuments(const Policy policy,
+    std::string_view raw_query, DocumentPredicate document_predicate, const CacheTag* cache_tag,
+    size_t max_count, BudgetMeter* budget) const {
+    ScratchLease<QueryScratch> scratch(GetThreadQueryScratch());
+    ParseQuery(raw_query, scratch->query);
+    return FindQueryTopDocuments(policy, scratch->query, nullptr, document_predicate, cache_tag, max_count,
+        *scratch, budget);
+}
+
+// Ищет документы по разобранному запросу, при включенном кэше запросов - сначала в кэше.
+// Ключ кэша строится по разобранному запросу, поэтому порядок и повторы слов, а также слова
+// не из словаря на него не влияют
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindQueryTopDocuments(const Policy policy, const Query& query,
+    const ResolvedQuery* resolved, DocumentPredicate document_predicate, const CacheTag* cache_tag,
+    size_t max_count, QueryScratch& scratch, BudgetMeter* budget) const {
+    std::optional<QueryCache::Key> key;
+    if (query_cache_ && cache_tag != nullptr) {
+        key = QueryCache::Key{ query.plus_terms, query.minus_terms, cache_tag->status,
+            std::string(cache_tag->predicate_key), std::is_same_v<Policy, std::execution::parallel_policy>,
+            max_count };
+        if (auto documents = query_cache_->Find(*key, generation_)) {
+            return std::move(*documents);
+        }
+    }
+
+    if (resolved == nullptr) {
+        ResolveQuery(query, scratch.resolved);
+        resolved = &scratch.resolved;
+    }
+
+    // Вместо полной сортировки найденных документов держим кучу из max_count лучших.
+    // Поиск выполняется циклами, скомпилированными для модели ранжирования запроса
+    scratch.top_documents.Reset(max_count);
+    std::visit([&](const auto& ranker) {
+        FindAllDocuments(policy, *resolved, ranker, document_predicate, scratch, budget);
+    }, resolved->ranker);
+    std::vector<Document> documents = scratch.top_documents.Extract();
+
+    if (key) {
+        query_cache_->Insert(std::move(*key), generation_, documents);
+    }
+    return documents;
+}
+
+// Ищет документы по подготовленному запросу. Если после подготовки индекс изменился
+// или запрос подготовлен другим сервером, слова запроса заново ищутся в словаре
+template <typename DocumentPredicate, typename Policy>
+std::vector<Document> SearchServer::FindPreparedTopDocuments(const Policy policy,
+    const PreparedQuery& query, DocumentPredicate document_predicate, const CacheTag* cache_tag,
+    size_t max_count, BudgetMeter* budget) const {
+    ScratchLease<QueryScratch> scratch(GetThreadQueryScratch());
+    if (query.epoch_ == epoch_.Get() && query.generation_ == generation_) {
+        return FindQueryTopDocuments(policy, query.query_, &query.resolved_, document_predicate, cache_tag,
+            max_count, *scratch, budget);
+    }
+    LookupQueryWords(query.plus_words_, query.minus_words_, scratch->query);
+    return FindQueryTopDocuments(policy, scratch->query, nullptr, document_predicate, cache_tag, max_count,
+        *scratch, budget);
+}
+
+// Передает в top_documents найденные по запросу документы без стоп и минус слов
+// согласно условию функции-предиката с последовательной политикой исполнения (алгоритм MaxScore).
+// Слова обходятся от самых весомых с накоплением релевантности в плотных счетчиках.
+// Как только сумма оценок оставшихся слов становится ниже порога входа в выдачу, новые документы
+// уже не могут в нее попасть: оставшиеся списки лишь дополняют релевантность отобранных кандидатов,
+// а короткий список кандидатов ищется в длинных списках вхождений с пропуском блоков.
+// Кандидаты, не способные набрать порог, отсеиваются по ходу проверки.
+// Счетчики и списки берутся из рабочей памяти потока: плотные массивы сбрасываются
+// лишь в документах, затронутых предыдущим запросом.
+// Если бюджет исчерпан, обход прекращается, и в выдачу идут отобранные кандидаты
+// с накопленной к этому моменту релевантностью
+template <typename Ranker, typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const ResolvedQuery& query,
+    const Ranker& ranker, DocumentPredicate document_predicate, QueryScratch& scratch,
+    BudgetMeter* budget) const {
+    const std::vector<ScoredTerm>& terms = query.plus_terms;
+    TopDocuments& top_documents = scratch.top_documents;
+
+    // remaining_max_score[i] - сумма оценок слов [i, terms.size())
+    std::vector<double>& remaining_max_score = scratch.remaining_max_score;
+    remaining_max_score.assign(terms.size() + 1, 0.0);
+    for (size_t i = terms.size(); i-- > 0;) {
+        remaining_max_score[i] = remaining_max_score[i + 1] + terms[i].max_score;
+    }
+
+    // Сброс выполняется перед поиском, поэтому и прерванный исключением запрос
+    // не оставляет следующему свои счетчики. Если прошлый запрос затронул заметную долю
+    // документов, массивы дешевле заполнить целиком, чем обходить их вразброс
+    std::vector<double>& relevances = scratch.relevances;
+    std::vector<char>& states = scratch.states;
+    std::vector<int>& seen_ids = scratch.seen_ids;
+    if (seen_ids.size() * DENSE_RESET_RATIO > relevances.size()) {
+        std::fill(relevances.begin(), relevances.end(), 0.0);
+        std::fill(states.begin(), states.end(), UNSEEN);
+    }
+    else {
+        for (int internal_id : seen_ids) {
+            relevances[internal_id] = 0.0;
+            states[internal_id] = UNSEEN;
+        }
+    }
+    seen_ids.clear();
+
+    const size_t id_count = document_external_ids_.size();
+    if (relevances.size() < id_count) {
+        relevances.resize(id_count, 0.0);
+        states.resize(id_count, UNSEEN);
+    }
+    std::vector<int>& accepted_ids = scratch.accepted_ids;
+    accepted_ids.clear();
+
+    // Бюджет списывается перед каждым блоком плюс-слов. Списки минус-слов проходятся целиком:
+    // без них в частичную выдачу попали бы исключенные документы
+    const auto can_continue = [budget](size_t posting_count) {
+        return budget == nullptr || budget->Spend(posting_count);
+    };
+    bool is_stopped = false;
+
+    for (const TermPostings& postings : query.minus_terms) {
+        postings.ForEach([&](int internal_id, int) {
+            if (states[internal_id] == UNSEEN) {
+                states[internal_id] = REJECTED;
+                seen_ids.push_back(internal_id);
+            }
+        });
+    }
+
+    // Релевантность max_count-го лучшего документа не ниже порога: частичные суммы не превышают
+    // итоговых. Запас в две точности покрывает сравнение рейтингов при равной релевантности
+    const size_t max_count = top_documents.GetMaxCount();
+    double threshold = -std::numeric_limits<double>::infinity();
+    double max_relevance = 0.0;
+
+    // Куча max_count лучших сумм, увиденных при проходе одного списка
+    std::vector<double>& best_relevances = scratch.best_relevances;
+    best_relevances.clear();
+    const auto track_relevance = [&](double relevance) {
+        if (best_relevances.size() < max_count) {
+            best_relevances.push_back(relevance);
+            std::push_heap(best_relevances.begin(), best_relevances.end(), std::greater<double>());
+        }
+        else if (relevance > best_relevances.front()) {
+            std::pop_heap(best_relevances.begin(), best_relevances.end(), std::greater<double>());
+            best_relevances.back() = relevance;
+            std::push_heap(best_relevances.begin(), best_relevances.end(), std::greater<double>());
+        }
+    };
+    const auto raise_threshold = [&]() {
+        if (max_count > 0 && best_relevances.size() == max_count) {
+            threshold = std::max(threshold, best_relevances.front() - 2 * DOUBLE_ACCURACY);
+        }
+        best_relevances.clear();
+    };
+
+    size_t term_index = 0;
+    for (; term_index < terms.size() && !(remaining_max_score[term_index] < threshold); ++term_index) {
+        const ScoredTerm& term = terms[term_index];
+
+        // Порог имеет смысл пересчитывать, лишь когда остаток оценок может оказаться ниже него:
+        // он не выше лучшей релевантности и не дальше чем вдвое от прежнего порога
+        const double remaining_after = remaining_max_score[term_index + 1];
+        const bool is_tracking = max_count > 0 && remaining_after < max_relevance
+            && (threshold < 0.0 || remaining_after < 2 * threshold);
+        const bool is_complete = term.postings.ForEachWhile([&](int internal_id, int count) {
+            char& state = states[internal_id];
+            if (state == UNSEEN) {
+                seen_ids.push_back(internal_id);
+                state = !document_is_removed_[internal_id] && document_predicate(document_external_ids_[internal_id],
+                    document_statuses_[internal_id], document_ratings_[internal_id]) ? ACCEPTED : REJECTED;
+                if (state == ACCEPTED) {
+                    accepted_ids.push_back(internal_id);
+                }
+            }
+            if (state == ACCEPTED) {
+                double& relevance = relevances[internal_id];
+                relevance += ranker.ComputeTermScore(internal_id, count) * term.weight;
+                max_relevance = std::max(max_relevance, relevance);
+                if (is_tracking) {
+                    track_relevance(relevance);
+                }
+            }
+        }, can_continue);
+        if (!is_complete) {
+            is_stopped = true;
+            break;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+        raise_threshold();
+    }
+
+    std::vector<int>& candidates = scratch.candidates;
+    candidates.clear();
+    if (term_index == terms.size()) {
+        candidates.swap(accepted_ids);
+    }
+    else {
+        for (int internal_id : accepted_ids) {
+            if (relevances[internal_id] + remaining_max_score[term_index] >= threshold) {
+                candidates.push_back(internal_id);
             }
         }
     }
+    bool is_sorted = false;
+
+    // При поиске кандидатов курсором каждый кандидат считается одним вхождением
+    size_t unspent_postings = 0;
+
+    for (; !is_stopped && term_index < terms.size(); ++term_index) {
+        const ScoredTerm& term = terms[term_index];
+        const double remaining_after = remaining_max_score[term_index + 1];
 
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+        // Если кандидатов много относительно длины списка, дешевле пройти список подряд
+        if (candidates.size() * SPARSE_CANDIDATES_RATIO >= term.postings.Size()) {
+            is_stopped = !term.postings.ForEachWhile([&](int internal_id, int count) {
+                if (states[internal_id] == ACCEPTED) {
+                    relevances[internal_id] += ranker.ComputeTermScore(internal_id, count) * term.weight;
+                }
+            }, can_continue);
             continue;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+
+        if (!is_sorted) {
+            std::sort(candidates.begin(), candidates.end());
+            is_sorted = true;
         }
-    }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
+        TermPostings::Cursor cursor = term.postings.GetCursor();
+        size_t kept = 0;
+        for (int internal_id : candidates) {
+            double& relevance = relevances[internal_id];
+            if (relevance + remaining_max_score[term_index] < threshold) {
+                continue;
+            }
+            if (!is_stopped && budget != nullptr && ++unspent_postings == PostingList::BLOCK_SIZE) {
+                unspent_postings = 0;
+                is_stopped = !budget->Spend(PostingList::BLOCK_SIZE);
+            }
+            // Блок, где мог бы лежать кандидат, оценивается до поиска внутри него
+            if (!is_stopped && relevance + remaining_after
+                + ranker.ComputeMaxTermScore(cursor.AdvanceBlock(internal_id)) * term.weight >= threshold) {
+                cursor.Advance(internal_id);
+                if (cursor.GetDocumentId() == internal_id) {
+                    relevance += ranker.ComputeTermScore(internal_id, cursor.GetCount()) * term.weight;
+                }
+            }
+            candidates[kept++] = internal_id;
+            track_relevance(relevance);
+        }
+        candidates.resize(kept);
+        raise_threshold();
     }
-    return matched_documents;
-}
 
-// Возвращает вектор всех найденных по запросу документов без стоп и минус слов
-// согласно условию функции-предиката с последовательной политикой исполнения
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&,
-    const Query& query, DocumentPredicate document_predicate) const {
-    return SearchServer::FindAllDocuments(query, document_predicate);
+    // После остановки по бюджету кандидатами остаются все отобранные документы. Документ
+    // с релевантностью ниже худшего в выдаче больше чем на точность сравнения не вытеснит его,
+    // и его данные не читаются
+    for (int internal_id : candidates) {
+        const double relevance = relevances[internal_id];
+        if (max_count > 0 && top_documents.IsFull()
+            && relevance < top_documents.GetWorst().relevance - DOUBLE_ACCURACY) {
+            continue;
+        }
+        top_documents.Add({ document_external_ids_[internal_id], relevance, document_ratings_[internal_id] });
+    }
 }
 
-// Возвращает вектор всех найденных по запросу документов без стоп и минус слов
+// Передает в top_documents все найденные по запросу документы без стоп и минус слов
 // согласно условию функции-предиката с параллельной политикой исполнения
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&,
-    const Query& query, DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(document_ids_.size() / 4);
+template <typename Ranker, typename DocumentPredicate>
+void SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const ResolvedQuery& query,
+    const Ranker& ranker, DocumentPredicate document_predicate, QueryScratch& scratch,
+    BudgetMeter* budget) const {
+    const std::vector<ScoredTerm>& plus_terms = query.plus_terms;
+    const std::vector<TermPostings>& minus_terms = query.minus_terms;
 
-    for_each(std::execution::par, query.plus_words.begin(), query.plus_words.end(),
-        [&](std::string_view word) {
-            if (word_to_document_freqs_.find(word) == word_to_document_freqs_.end()) {
+    // Пространство внутренних id делится на непересекающиеся диапазоны. Каждая задача проходит
+    // по своему участку всех списков вхождений и копит релевантность в собственных счетчиках,
+    // поэтому синхронизация не нужна, а длинный список делится между всеми ядрами.
+    // Слова складываются в том же порядке, что и при последовательном поиске.
+    // Счетчики задачи берутся из рабочей памяти исполняющего ее потока
+    TopDocuments& top_documents = scratch.top_documents;
+    const size_t id_count = document_external_ids_.size();
+    const size_t chunk_count = std::max<size_t>(std::thread::hardware_concurrency(), 1) * 4;
+    const size_t chunk_size = (id_count + chunk_count - 1) / chunk_count;
+    std::vector<std::vector<Document>>& chunk_top_documents = scratch.chunk_top_documents;
+    if (chunk_top_documents.size() < chunk_count) {
+        chunk_top_documents.resize(chunk_count);
+    }
+
+    std::vector<size_t>& chunks = scratch.chunks;
+    chunks.resize(chunk_count);
+    std::iota(chunks.begin(), chunks.end(), 0);
+    for_each(std::execution::par, chunks.begin(), chunks.end(),
+        [&](size_t chunk) {
+            std::vector<Document>& documents = chunk_top_documents[chunk];
+            documents.clear();
+            const int begin = static_cast<int>(std::min(id_count, chunk * chunk_size));
+            const int end = static_cast<int>(std::min(id_count, (chunk + 1) * chunk_size));
+            if (begin == end) {
                 return;
             }
 
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto& [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+            ScratchLease<ChunkScratch> chunk_scratch(GetThreadChunkScratch());
+            std::vector<double>& relevances = chunk_scratch->relevances;
+            std::vector<char>& is_matched = chunk_scratch->is_matched;
+            relevances.assign(end - begin, 0.0);
+            is_matched.assign(end - begin, false);
+
+            // Бюджет общий для всех участков и списывается блоками по BLOCK_SIZE пройденных вхождений
+            size_t unspent_postings = 0;
+            bool is_stopped = false;
+            for (const ScoredTerm& term : plus_terms) {
+                if (is_stopped) {
+                    break;
+                }
+                TermPostings::Cursor cursor = term.postings.GetCursor();
+                for (cursor.Advance(begin); cursor.GetDocumentId() < end; cursor.Next()) {
+                    if (budget != nullptr && ++unspent_postings == PostingList::BLOCK_SIZE) {
+                        unspent_postings = 0;
+                        if (!budget->Spend(PostingList::BLOCK_SIZE)) {
+                            is_stopped = true;
+                            break;
+                        }
+                    }
+                    const int internal_id = cursor.GetDocumentId();
+                    if (!document_is_removed_[internal_id] && document_predicate(document_external_ids_[internal_id],
+                        document_statuses_[internal_id], document_ratings_[internal_id])) {
+                        relevances[internal_id - begin] += ranker.ComputeTermScore(internal_id, cursor.GetCount())
+                            * term.weight;
+                        is_matched[internal_id - begin] = true;
+                    }
                 }
             }
-        });
 
-    for_each(std::execution::par, query.minus_words.begin(), query.minus_words.end(),
-        [&](std::string_view word) {
-            if (word_to_document_freqs_.find(word) == word_to_document_freqs_.end()) {
-                return;
+            for (const TermPostings& postings : minus_terms) {
+                TermPostings::Cursor cursor = postings.GetCursor();
+                for (cursor.Advance(begin); cursor.GetDocumentId() < end; cursor.Next()) {
+                    is_matched[cursor.GetDocumentId() - begin] = false;
+                }
             }
 
-            for (const auto& [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.Delete(document_id);
+            TopDocuments& chunk_top = chunk_scratch->top_documents;
+            chunk_top.Reset(top_documents.GetMaxCount());
+            for (int internal_id = begin; internal_id < end; ++internal_id) {
+                if (is_matched[internal_id - begin]) {
+                    chunk_top.Add({ document_external_ids_[internal_id],
+                        relevances[internal_id - begin], document_ratings_[internal_id] });
+                }
             }
+            chunk_top.ExtractTo(documents);
         });
 
-
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        const std::vector<Document>& documents = chunk_top_documents[chunk];
+        for (const Document& document : documents) {
+            top_documents.Add(document);
+        }
     }
-
-    return matched_documents;
 }
+
@@ -0,0 +1,195 @@
+#include "segment.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// Пустой список, с которого начинает курсор слова без вхождений
+const PostingList EMPTY_POSTINGS;
+
+} // namespace
+
+// level - уровень сегмента в политике слияния, см. SearchServer::StartMerge.
+// document_count - кол-во документов диапазона, чьи вхождения есть в сегменте
+Segment::Segment(int first_document_id, int end_document_id, int level, int document_count,
+    vector<int> term_ids, vector<PostingList> term_postings)
+    : first_document_id_(first_document_id)
+    , end_document_id_(end_document_id)
+    , level_(level)
+    , document_count_(document_count)
+    , term_ids_(move(term_ids))
+    , term_postings_(move(term_postings)) {
+}
+
+// Возвращает список вхождений слова либо nullptr, если слова в сегменте нет
+const PostingList* Segment::Find(int term_id) const {
+    const auto it = lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id) {
+        return nullptr;
+    }
+    return &term_postings_[it - term_ids_.begin()];
+}
+
+int Segment::GetFirstDocumentId() const {
+    return first_document_id_;
+}
+
+int Segment::GetEndDocumentId() const {
+    return end_document_id_;
+}
+
+int Segment::GetLevel() const {
+    return level_;
+}
+
+int Segment::GetDocumentCount() const {
+    return document_count_;
+}
+
+// Сливает соседние сегменты в один уровня level, отбрасывая вхождения удаленных документов
+Segment Segment::Merge(const vector<shared_ptr<const Segment>>& segments, int level,
+    const vector<char>& is_removed, const vector<double>& inv_word_counts) {
+    const int first_document_id = segments.front()->first_document_id_;
+    vector<int> new_ids(is_removed.size());
+    for (size_t offset = 0; offset < is_removed.size(); ++offset) {
+        new_ids[offset] = is_removed[offset] ? PostingList::NO_DOCUMENT
+            : first_document_id + static_cast<int>(offset);
+    }
+    return Renumber(segments, first_document_id, segments.back()->end_document_id_, level,
+        new_ids, inv_word_counts);
+}
+
+// Сливает соседние сегменты в сегмент [first_document_id, end_document_id) уровня level,
+// назначая документам новые внутренние id
+Segment Segment::Renumber(const vector<shared_ptr<const Segment>>& segments,
+    int first_document_id, int end_document_id, int level,
+    const vector<int>& new_ids, const vector<double>& inv_word_counts) {
+    const int old_first_document_id = segments.front()->first_document_id_;
+
+    vector<int> all_term_ids;
+    for (const auto& segment : segments) {
+        all_term_ids.insert(all_term_ids.end(), segment->term_ids_.begin(), segment->term_ids_.end());
+    }
+    sort(all_term_ids.begin(), all_term_ids.end());
+    all_term_ids.erase(unique(all_term_ids.begin(), all_term_ids.end()), all_term_ids.end());
+
+    // Слова каждого сегмента упорядочены, поэтому на сегмент хватает одной позиции
+    vector<size_t> positions(segments.size(), 0);
+    vector<int> term_ids;
+    vector<PostingList> term_postings;
+    for (int term_id : all_term_ids) {
+        PostingList merged;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Segment& segment = *segments[i];
+            if (positions[i] == segment.term_ids_.size() || segment.term_ids_[positions[i]] != term_id) {
+                continue;
+            }
+            segment.term_postings_[positions[i]++].ForEach([&](int document_id, int count) {
+                const size_t offset = static_cast<size_t>(document_id - old_first_document_id);
+                if (new_ids[offset] != PostingList::NO_DOCUMENT) {
+                    merged.Add(new_ids[offset], count, count * inv_word_counts[offset]);
+                }
+            });
+        }
+        if (!merged.IsEmpty()) {
+            term_ids.push_back(term_id);
+            term_postings.push_back(move(merged));
+        }
+    }
+
+    const int document_count = static_cast<int>(count_if(new_ids.begin(), new_ids.end(), [](int id) {
+        return id != PostingList::NO_DOCUMENT;
+        }));
+    return Segment(first_document_id, end_document_id, level, document_count,
+        move(term_ids), move(term_postings));
+}
+
+TermPostings::Cursor::Cursor(const TermPostings& postings)
+    : postings_(&postings)
+    , cursor_(postings.lists_.empty() ? EMPTY_POSTINGS : *postings.lists_[0].postings) {
+    SkipExhausted();
+}
+
+// Возвращает id текущего документа либо PostingList::NO_DOCUMENT
+int TermPostings::Cursor::GetDocumentId() const {
+    return cursor_.GetDocumentId();
+}
+
+// Возвращает кол-во повторений слова в текущем документе
+int TermPostings::Cursor::GetCount() const {
+    return cursor_.GetCount();
+}
+
+// Переходит к следующему вхождению
+void TermPostings::Cursor::Next() {
+    cursor_.Next();
+    if (cursor_.GetDocumentId() == PostingList::NO_DOCUMENT) {
+        SkipExhausted();
+    }
+}
+
+// Переходит к первому вхождению с id не меньше заданного
+void TermPostings::Cursor::Advance(int document_id) {
+    SeekList(document_id);
+    cursor_.Advance(document_id);
+    SkipExhausted();
+}
+
+// Переходит к блоку, где мог бы находиться документ, не распаковывая его
+double TermPostings::Cursor::AdvanceBlock(int document_id) {
+    SeekList(document_id);
+    return cursor_.AdvanceBlock(document_id);
+}
+
+// Переходит к последнему списку, начинающемуся не правее документа
+void TermPostings::Cursor::SeekList(int document_id) {
+    const auto& lists = postings_->lists_;
+    const size_t list = list_;
+    while (list_ + 1 < lists.size() && lists[list_ + 1].first_document_id <= document_id) {
+        ++list_;
+    }
+    if (list_ != list) {
+        cursor_ = PostingList::Cursor(*lists[list_].postings);
+    }
+}
+
+// Переходит к началу следующих списков, пока текущий исчерпан
+void TermPostings::Cursor::SkipExhausted() {
+    const auto& lists = postings_->lists_;
+    while (cursor_.GetDocumentId() == PostingList::NO_DOCUMENT && list_ + 1 < lists.size()) {
+        cursor_ = PostingList::Cursor(*lists[++list_].postings);
+    }
+}
+
+// Дописывает список сегмента, начинающегося с документа first_document_id
+void TermPostings::Add(const PostingList* postings, int first_document_id) {
+    lists_.push_back({ postings, first_document_id });
+}
+
+// Возвращает кол-во вхождений во всех списках, включая вхождения удаленных документов
+size_t TermPostings::Size() const {
+    size_t size = 0;
+    for (const SegmentList& list : lists_) {
+        size += list.postings->Size();
+    }
+    return size;
+}
+
+bool TermPostings::IsEmpty() const {
+    return Size() == 0;
+}
+
+// Возвращает оценку сверху частоты слова по всем спискам
+double TermPostings::GetMaxTermFreq() const {
+    double max_term_freq = 0.0;
+    for (const SegmentList& list : lists_) {
+        max_term_freq = max(max_term_freq, list.postings->GetMaxTermFreq());
+    }
+    return max_term_freq;
+}
+
+TermPostings::Cursor TermPostings::GetCursor() const {
+    return Cursor(*this);
+}
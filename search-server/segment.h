@@ -0,0 +1,145 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "posting_list.h"
+#include "small_vector.h"
+
+// Запечатанный сегмент индекса: списки вхождений слов в документы с внутренними id
+// из диапазона [first_document_id, end_document_id). После создания не меняется, поэтому
+// может сливаться с соседними в фоновом потоке, пока сервер принимает запросы и изменения.
+// Хранит только встретившиеся в сегменте слова по возрастанию их id
+class Segment {
+public:
+    // level - уровень сегмента в политике слияния, см. SearchServer::StartMerge.
+    // document_count - кол-во документов диапазона, чьи вхождения есть в сегменте
+    Segment(int first_document_id, int end_document_id, int level, int document_count,
+        std::vector<int> term_ids, std::vector<PostingList> term_postings);
+
+    // Возвращает список вхождений слова либо nullptr, если слова в сегменте нет
+    const PostingList* Find(int term_id) const;
+
+    int GetFirstDocumentId() const;
+
+    int GetEndDocumentId() const;
+
+    int GetLevel() const;
+
+    int GetDocumentCount() const;
+
+    // Сливает соседние сегменты в один уровня level, отбрасывая вхождения удаленных документов.
+    // is_removed и inv_word_counts - признаки удаления и 1 / кол-во слов документов
+    // диапазона слитого сегмента по порядку внутренних id
+    static Segment Merge(const std::vector<std::shared_ptr<const Segment>>& segments, int level,
+        const std::vector<char>& is_removed, const std::vector<double>& inv_word_counts);
+
+    // Сливает соседние сегменты в сегмент [first_document_id, end_document_id) уровня level,
+    // назначая документам новые внутренние id: документ с id первого сегмента + i получает
+    // new_ids[i], вхождения документов с new_ids[i] == PostingList::NO_DOCUMENT отбрасываются.
+    // Новые id должны возрастать в порядке прежних, тогда списки вхождений остаются упорядоченными
+    static Segment Renumber(const std::vector<std::shared_ptr<const Segment>>& segments,
+        int first_document_id, int end_document_id, int level,
+        const std::vector<int>& new_ids, const std::vector<double>& inv_word_counts);
+
+private:
+    int first_document_id_;
+    int end_document_id_;
+    int level_;
+    int document_count_;
+    std::vector<int> term_ids_;
+    std::vector<PostingList> term_postings_;
+};
+
+// Вхождения слова во всех сегментах индекса. Сегменты идут по возрастанию id документов,
+// поэтому обход списков по порядку дает вхождения по возрастанию id
+class TermPostings {
+public:
+    // Курсор, переходящий от списка к списку. Списки, лежащие целиком левее искомого id,
+    // пропускаются без распаковки
+    class Cursor {
+    public:
+        explicit Cursor(const TermPostings& postings);
+
+        // Возвращает id текущего документа либо PostingList::NO_DOCUMENT
+        int GetDocumentId() const;
+
+        // Возвращает кол-во повторений слова в текущем документе
+        int GetCount() const;
+
+        // Переходит к следующему вхождению
+        void Next();
+
+        // Переходит к первому вхождению с id не меньше заданного
+        void Advance(int document_id);
+
+        // Переходит к блоку, где мог бы находиться документ, не распаковывая его.
+        // Возвращает оценку частоты в этом блоке либо 0, если таких вхождений нет
+        double AdvanceBlock(int document_id);
+
+    private:
+        const TermPostings* postings_;
+        size_t list_ = 0;
+        PostingList::Cursor cursor_;
+
+        // Переходит к последнему списку, начинающемуся не правее документа
+        void SeekList(int document_id);
+
+        // Переходит к началу следующих списков, пока текущий исчерпан
+        void SkipExhausted();
+    };
+
+    // Дописывает список сегмента, начинающегося с документа first_document_id
+    void Add(const PostingList* postings, int first_document_id);
+
+    // Возвращает кол-во вхождений во всех списках, включая вхождения удаленных документов
+    size_t Size() const;
+
+    bool IsEmpty() const;
+
+    // Возвращает оценку сверху частоты слова по всем спискам
+    double GetMaxTermFreq() const;
+
+    Cursor GetCursor() const;
+
+    // Вызывает function(id документа, кол-во) для всех вхождений по возрастанию id
+    template <typename Function>
+    void ForEach(Function function) const;
+
+    // Как ForEach, но прекращает обход, если can_continue(кол-во вхождений в блоке) перед
+    // очередным блоком вернул false. Возвращает true, если пройдены все списки
+    template <typename Function, typename Condition>
+    bool ForEachWhile(Function function, Condition can_continue) const;
+
+private:
+    struct SegmentList {
+        const PostingList* postings;
+        int first_document_id;
+    };
+
+    // Сегментов с вхождениями слова обычно немного: их число растет логарифмически
+    // с размером индекса, поэтому списки хранятся в объекте без выделения памяти
+    static const size_t INLINE_LIST_COUNT = 16;
+
+    SmallVector<SegmentList, INLINE_LIST_COUNT> lists_;
+};
+
+// Вызывает function(id документа, кол-во) для всех вхождений по возрастанию id
+template <typename Function>
+void TermPostings::ForEach(Function function) const {
+    for (const SegmentList& list : lists_) {
+        list.postings->ForEach(function);
+    }
+}
+
+// Как ForEach, но прекращает обход, если can_continue(кол-во вхождений в блоке) перед
+// очередным блоком вернул false. Возвращает true, если пройдены все списки
+template <typename Function, typename Condition>
+bool TermPostings::ForEachWhile(Function function, Condition can_continue) const {
+    for (const SegmentList& list : lists_) {
+        if (!list.postings->ForEachWhile(function, can_continue)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Вектор, первые N элементов которого хранятся в самом объекте: пока элементов не больше N,
+// память в куче не выделяется. Для тривиально копируемых типов
+template <typename T, size_t N>
+class SmallVector {
+    static_assert(std::is_trivially_copyable_v<T>, "SmallVector stores trivially copyable types");
+
+public:
+    void push_back(const T& value) {
+        if (size_ < N) {
+            inline_[size_] = value;
+        }
+        else {
+            // При переполнении все элементы переезжают в кучу
+            if (size_ == N) {
+                heap_.assign(inline_, inline_ + N);
+            }
+            heap_.push_back(value);
+        }
+        ++size_;
+    }
+
+    // Удаляет элементы, сохраняя выделенную память
+    void clear() {
+        size_ = 0;
+        heap_.clear();
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    const T* data() const {
+        return size_ <= N ? inline_ : heap_.data();
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + size_;
+    }
+
+private:
+    T inline_[N] = {};
+    size_t size_ = 0;
+    std::vector<T> heap_;
+};
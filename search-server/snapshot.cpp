@@ -0,0 +1,164 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Дополняет контрольную сумму FNV-1a 64 байтами data
+uint64_t UpdateChecksum(uint64_t checksum, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        checksum = (checksum ^ data[i]) * 1099511628211ULL;
+    }
+    return checksum;
+}
+
+// Сбрасывает записанные в файл данные на диск, возвращает false при ошибке
+bool SyncFile(FILE* file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Сбрасывает на диск каталог, в котором лежит path. На Windows каталог не открывается
+// как файл, а переименование и так сохраняется журналом NTFS
+bool SyncParentDirectory(const string& path) {
+#ifdef _WIN32
+    return true;
+#else
+    string directory = filesystem::path(path).parent_path().string();
+    if (directory.empty()) {
+        directory = "."s;
+    }
+    const int descriptor = open(directory.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    const bool is_synced = fsync(descriptor) == 0;
+    close(descriptor);
+    return is_synced;
+#endif
+}
+
+SnapshotWriter::SnapshotWriter(const string& path)
+    : path_(path)
+    , temp_path_(path + ".tmp"s)
+    , file_(fopen(temp_path_.c_str(), "wb")) {
+    if (file_ == nullptr) {
+        throw runtime_error("Cannot create "s + temp_path_);
+    }
+
+    // Место под заголовок, он записывается в Finish, когда известны размер и контрольная сумма
+    const SnapshotHeader header{};
+    if (fwrite(&header, sizeof(header), 1, file_) != 1) {
+        fclose(file_);
+        remove(temp_path_.c_str());
+        throw runtime_error("Cannot write "s + temp_path_);
+    }
+}
+
+// Удаляет временный файл, если снимок не завершен
+SnapshotWriter::~SnapshotWriter() {
+    if (file_ != nullptr) {
+        fclose(file_);
+        remove(temp_path_.c_str());
+    }
+}
+
+// Записывает заголовок, сбрасывает файл на диск и переименовывает его. Снимок становится
+// виден по пути path только целиком, и переименование сбрасывается на диск до возврата,
+// поэтому очищать журнал изменений после Finish безопасно
+void SnapshotWriter::Finish() {
+    Align();
+
+    SnapshotHeader header{};
+    copy(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC), header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER_MARK;
+    header.payload_size = size_;
+    header.checksum = checksum_;
+    const bool is_written = fseek(file_, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, file_) == 1
+        && fflush(file_) == 0
+        && SyncFile(file_);
+    const bool is_closed = fclose(file_) == 0;
+    file_ = nullptr;
+    if (!is_written || !is_closed) {
+        remove(temp_path_.c_str());
+        throw runtime_error("Cannot write "s + temp_path_);
+    }
+
+    if (rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        // На Windows rename не заменяет существующий файл
+        remove(path_.c_str());
+        if (rename(temp_path_.c_str(), path_.c_str()) != 0) {
+            throw runtime_error("Cannot replace "s + path_);
+        }
+    }
+    if (!SyncParentDirectory(path_)) {
+        throw runtime_error("Cannot sync directory of "s + path_);
+    }
+}
+
+void SnapshotWriter::WriteBytes(const uint8_t* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, file_) != size) {
+        throw runtime_error("Cannot write "s + temp_path_);
+    }
+    checksum_ = UpdateChecksum(checksum_, data, size);
+    size_ += size;
+}
+
+// Дополняет данные нулями до границы 8 байт
+void SnapshotWriter::Align() {
+    static const uint8_t zeros[8] = {};
+    if (size_ % 8 != 0) {
+        WriteBytes(zeros, 8 - size_ % 8);
+    }
+}
+
+// Проверяет заголовок снимка, а при verification == FULL и контрольную сумму данных.
+// Подсчет суммы обращается к каждой странице, поэтому по умолчанию он не выполняется
+SnapshotReader::SnapshotReader(const uint8_t* data, size_t size, SnapshotVerification verification) {
+    if (size < sizeof(SnapshotHeader)) {
+        throw invalid_argument("Snapshot is truncated");
+    }
+    SnapshotHeader header;
+    copy(data, data + sizeof(header), reinterpret_cast<uint8_t*>(&header));
+
+    if (!equal(begin(SNAPSHOT_MAGIC), end(SNAPSHOT_MAGIC), header.magic)) {
+        throw invalid_argument("File is not a search server snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw invalid_argument("Unsupported snapshot version " + to_string(header.version));
+    }
+    if (header.byte_order != SNAPSHOT_BYTE_ORDER_MARK) {
+        throw invalid_argument("Snapshot was written with a different byte order");
+    }
+    if (header.payload_size != size - sizeof(header)) {
+        throw invalid_argument("Snapshot is truncated");
+    }
+
+    begin_ = data + sizeof(header);
+    position_ = begin_;
+    end_ = begin_ + header.payload_size;
+    if (verification == SnapshotVerification::FULL
+        && UpdateChecksum(CHECKSUM_BASIS, begin_, header.payload_size) != header.checksum) {
+        throw invalid_argument("Snapshot checksum mismatch");
+    }
+}
+
+// Пропускает выравнивание до границы 8 байт
+void SnapshotReader::Align() {
+    const size_t offset = static_cast<size_t>(position_ - begin_);
+    position_ += min<size_t>((8 - offset % 8) % 8, static_cast<size_t>(end_ - position_));
+}
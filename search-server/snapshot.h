@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// Двоичный снимок индекса. Файл начинается с заголовка, за ним идут данные, в которых каждый
+// массив выровнен на 8 байт, поэтому при отображении файла в память данные читаются на месте.
+// Числа записываются в порядке байт машины, признак порядка хранится в заголовке
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    // BYTE_ORDER_MARK в порядке байт записавшей машины
+    uint64_t payload_size;  // Размер данных за заголовком
+    uint64_t checksum;      // FNV-1a 64 по данным за заголовком
+};
+
+const char SNAPSHOT_MAGIC[8] = { 'S', 'R', 'C', 'H', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 2;
+const uint32_t SNAPSHOT_BYTE_ORDER_MARK = 0x01020304;
+
+// Дополняет контрольную сумму FNV-1a 64 байтами data
+uint64_t UpdateChecksum(uint64_t checksum, const uint8_t* data, size_t size);
+
+// Начальное значение контрольной суммы FNV-1a 64
+const uint64_t CHECKSUM_BASIS = 14695981039346656037ULL;
+
+// Проверка снимка при загрузке
+enum class SnapshotVerification {
+    STRUCTURE, // Заголовок, размеры и границы массивов. Страницы данных не читаются заранее
+    FULL,      // Также контрольная сумма всех данных: читает файл целиком
+};
+
+// Сбрасывает записанные в файл данные на диск, возвращает false при ошибке
+bool SyncFile(std::FILE* file);
+
+// Сбрасывает на диск каталог, в котором лежит path, чтобы созданный или переименованный
+// в нем файл пережил сбой. Возвращает false при ошибке
+bool SyncParentDirectory(const std::string& path);
+
+// Записывает снимок во временный файл и по Finish атомарно заменяет им файл path.
+// Finish сбрасывает файл на диск до переименования, а каталог - после, поэтому после сбоя
+// по пути path лежит либо старый, либо новый снимок целиком. Бросает runtime_error при ошибке записи
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path);
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // Удаляет временный файл, если снимок не завершен
+    ~SnapshotWriter();
+
+    template <typename T>
+    void Write(const T& value) {
+        WriteArray(&value, 1);
+    }
+
+    // Записывает массив, выравнивая его начало
+    template <typename T>
+    void WriteArray(const T* data, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types are stored");
+        Align();
+        WriteBytes(reinterpret_cast<const uint8_t*>(data), count * sizeof(T));
+    }
+
+    // Дописывает элементы вплотную к предыдущему массиву, продолжая его
+    template <typename T>
+    void AppendArray(const T* data, size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types are stored");
+        WriteBytes(reinterpret_cast<const uint8_t*>(data), count * sizeof(T));
+    }
+
+    // Записывает заголовок, сбрасывает файл на диск и переименовывает его
+    void Finish();
+
+private:
+    std::string path_;
+    std::string temp_path_;
+    std::FILE* file_ = nullptr;
+    uint64_t size_ = 0;
+    uint64_t checksum_ = CHECKSUM_BASIS;
+
+    void WriteBytes(const uint8_t* data, size_t size);
+
+    // Дополняет данные нулями до границы 8 байт
+    void Align();
+};
+
+// Последовательно читает данные снимка, лежащие в памяти, без копирования.
+// Бросает invalid_argument, если данные повреждены или выходят за границы снимка
+class SnapshotReader {
+public:
+    // Проверяет заголовок снимка, а при verification == FULL и контрольную сумму данных
+    SnapshotReader(const uint8_t* data, size_t size, SnapshotVerification verification);
+
+    template <typename T>
+    T Read() {
+        return *ReadArray<T>(1);
+    }
+
+    // Возвращает указатель на массив внутри снимка
+    template <typename T>
+    const T* ReadArray(size_t count) {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable types are stored");
+        Align();
+        if (count > (end_ - position_) / sizeof(T)) {
+            throw std::invalid_argument("Snapshot is truncated");
+        }
+        const T* result = reinterpret_cast<const T*>(position_);
+        position_ += count * sizeof(T);
+        return result;
+    }
+
+private:
+    const uint8_t* begin_;
+    const uint8_t* position_;
+    const uint8_t* end_;
+
+    // Пропускает выравнивание до границы 8 байт
+    void Align();
+};
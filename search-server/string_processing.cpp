@@ -1,27 +1,92 @@
 #include "string_processing.h"
 
-using namespace std;
-
-//    string_view,   
-vector<string_view> SplitIntoWords(string_view text) {
-    vector<string_view> result;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
-    //        
-    size_t pos = text.find_first_not_of(' ');
-    text.remove_prefix(pos == text.npos ? text.length() : pos);
-
-    while (!text.empty()) {
-        //  ,     ,    result
-        pos = text.find_first_of(' ');
-        result.push_back(text.substr(0, (pos == text.npos ? text.length() : pos)));
+using namespace std;
 
-        //         ( )
-        text.remove_prefix(pos == text.npos ? text.length() : ++pos);
+//     - .    32 (AVX2)  16 (SSE2)
+//   ,    - 
+TextBlockMasks ClassifyTextBlock(const char* block) {
+    TextBlockMasks masks;
+#if defined(__AVX2__)
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    const __m256i minus_ones = _mm256_set1_epi8(-1);
+    for (size_t i = 0; i < TEXT_BLOCK_SIZE; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        //  - -,       -1   
+        const __m256i control_characters = _mm256_and_si256(
+            _mm256_cmpgt_epi8(bytes, minus_ones), _mm256_cmpgt_epi8(spaces, bytes));
+        masks.spaces |= uint64_t{ static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, spaces))) } << i;
+        masks.control_characters |= uint64_t{ static_cast<uint32_t>(
+            _mm256_movemask_epi8(control_characters)) } << i;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i minus_ones = _mm_set1_epi8(-1);
+    for (size_t i = 0; i < TEXT_BLOCK_SIZE; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        //  - -,       -1   
+        const __m128i control_characters = _mm_and_si128(
+            _mm_cmpgt_epi8(bytes, minus_ones), _mm_cmpgt_epi8(spaces, bytes));
+        masks.spaces |= uint64_t{ static_cast<uint16_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces))) } << i;
+        masks.control_characters |= uint64_t{ static_cast<uint16_t>(
+            _mm_movemask_epi8(control_characters)) } << i;
+    }
+#else
+    for (size_t i = 0; i < TEXT_BLOCK_SIZE; ++i) {
+        const char c = block[i];
+        masks.spaces |= uint64_t{ c == ' ' } << i;
+        masks.control_characters |= uint64_t{ c >= '\0' && c < ' ' } << i;
+    }
+#endif
+    return masks;
+}
 
-        //        ( )
-        pos = text.find_first_not_of(' ');
-        text.remove_prefix(pos == text.npos ? text.length() : pos);
+//  true,     - (  0  31)
+bool HasControlCharacters(string_view text) {
+    size_t block_begin = 0;
+    for (; text.size() - block_begin >= TEXT_BLOCK_SIZE; block_begin += TEXT_BLOCK_SIZE) {
+        if (ClassifyTextBlock(text.data() + block_begin).control_characters != 0) {
+            return true;
+        }
+    }
+    for (; block_begin < text.size(); ++block_begin) {
+        if (text[block_begin] >= '\0' && text[block_begin] < ' ') {
+            return true;
+        }
     }
+    return false;
+}
+
+//    string_view,   
+vector<string_view> SplitIntoWords(string_view text) {
+    bool has_control_characters = false;
+    return SplitIntoWords(text, has_control_characters);
+}
 
+//    string_view,   .      
+//  -: has_control_characters  true,     - 
+vector<string_view> SplitIntoWords(string_view text, bool& has_control_characters) {
+    vector<string_view> result;
+    has_control_characters = ForEachWord(text, [&result](string_view word) {
+        result.push_back(word);
+        });
     return result;
 }
+
+//     ,      
+set<string, less<>> MakeUniqueNonEmptyStrings(string_view text) {
+    set<string, less<>> non_empty_strings;
+    ForEachWord(text, [&non_empty_strings](string_view word) {
+        if (non_empty_strings.find(word) == non_empty_strings.end()) {
+            non_empty_strings.emplace(word);
+        }
+        });
+    return non_empty_strings;
+}
@@ -1,13 +1,95 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <set>
 #include <string_view>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Текст разбирается блоками по TEXT_BLOCK_SIZE байт: бит i маски соответствует i-му байту блока
+const size_t TEXT_BLOCK_SIZE = 64;
+
+struct TextBlockMasks {
+    uint64_t spaces = 0;
+    uint64_t control_characters = 0; // Спец-символы с кодами от 0 до 31
+};
+
+// Строит маски пробелов и спец-символов блока из TEXT_BLOCK_SIZE байт
+TextBlockMasks ClassifyTextBlock(const char* block);
+
+// Возвращает номер младшего установленного бита, mask не должна быть нулевой
+inline size_t CountTrailingZeros(uint64_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(mask));
+#endif
+}
+
+// Вызывает function(слово) для слов текста по порядку, не выделяя память.
+// Возвращает true, если в тексте есть спец-символы (коды от 0 до 31), то есть они есть
+// в каком-либо слове
+template <typename Function>
+bool ForEachWord(std::string_view text, Function function) {
+    uint64_t control_characters = 0;
+
+    // Граница слова - смена пробела на непробел или обратно. Маска границ блока получается
+    // сравнением маски непробелов с ней же, сдвинутой на байт, поэтому слова выделяются
+    // перебором установленных битов без проверки каждого байта
+    bool is_in_word = false; // Последний разобранный байт относится к слову
+    size_t word_begin = 0;
+    char tail[TEXT_BLOCK_SIZE];
+    for (size_t block_begin = 0; block_begin < text.size(); block_begin += TEXT_BLOCK_SIZE) {
+        const char* block = text.data() + block_begin;
+        if (text.size() - block_begin < TEXT_BLOCK_SIZE) {
+            // Неполный последний блок дополняется пробелами, которые завершают последнее слово
+            std::memset(tail, ' ', TEXT_BLOCK_SIZE);
+            std::memcpy(tail, block, text.size() - block_begin);
+            block = tail;
+        }
+
+        const TextBlockMasks masks = ClassifyTextBlock(block);
+        control_characters |= masks.control_characters;
+
+        const uint64_t word_bytes = ~masks.spaces;
+        for (uint64_t boundaries = word_bytes ^ ((word_bytes << 1) | uint64_t{ is_in_word });
+            boundaries != 0; boundaries &= boundaries - 1) {
+            const size_t position = block_begin + CountTrailingZeros(boundaries);
+            if (is_in_word) {
+                function(text.substr(word_begin, position - word_begin));
+            }
+            else {
+                word_begin = position;
+            }
+            is_in_word = !is_in_word;
+        }
+    }
+    if (is_in_word) {
+        function(text.substr(word_begin));
+    }
+
+    return control_characters != 0;
+}
+
+// Возвращает true, если в тексте есть спец-символы (коды от 0 до 31)
+bool HasControlCharacters(std::string_view text);
+
 // Принимает текст в string_view, возвращает вектор слов
 std::vector<std::string_view> SplitIntoWords(std::string_view text);
 
+// Принимает текст в string_view, возвращает вектор слов. За тот же проход проверяет текст
+// на спец-символы (коды от 0 до 31): has_control_characters становится true, если они есть
+// в каком-либо слове
+std::vector<std::string_view> SplitIntoWords(std::string_view text, bool& has_control_characters);
+
 // Возвращает словарь уникальных слов из строки
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
@@ -19,3 +101,6 @@ std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContain
     }
     return non_empty_strings;
 }
+
+// Возвращает словарь уникальных слов текста, разбирая его без промежуточного вектора слов
+std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(std::string_view text);
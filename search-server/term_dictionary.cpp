@@ -0,0 +1,171 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+// Добавляет стоп-слово
+void TermDictionary::AddStopWord(string_view word) {
+    is_stop_[Intern(word).id] = true;
+}
+
+// Возвращает слово, при отсутствии добавляя его как обычное
+TermDictionary::Term TermDictionary::Intern(string_view word) {
+    return Intern(word, Hash(word));
+}
+
+// Intern с заранее вычисленным хэшем слова (см. Hash)
+TermDictionary::Term TermDictionary::Intern(string_view word, size_t hash) {
+    // Заполненность таблицы держим не выше половины, чтобы цепочки проб оставались короткими
+    if ((GetWordCount() + 1) * 2 > slots_.size()) {
+        Rehash(max<size_t>(slots_.size() * 2, 16));
+    }
+
+    const size_t slot = FindSlot(word, hash);
+    if (slots_[slot] != NO_TERM) {
+        return { slots_[slot], static_cast<bool>(is_stop_[slots_[slot]]) };
+    }
+
+    int term_id = static_cast<int>(words_.size());
+    if (free_ids_.empty()) {
+        words_.emplace_back();
+        hashes_.push_back(0);
+        is_stop_.push_back(false);
+        is_borrowed_.push_back(false);
+    }
+    else {
+        term_id = free_ids_.back();
+        free_ids_.pop_back();
+    }
+    words_[term_id] = text_.Allocate(word);
+    hashes_[term_id] = hash;
+    is_stop_[term_id] = false;
+    is_borrowed_[term_id] = false;
+    slots_[slot] = term_id;
+    return { term_id, false };
+}
+
+// Возвращает слово либо Term с id NO_TERM, если его нет в словаре
+TermDictionary::Term TermDictionary::Find(string_view word) const {
+    if (slots_.empty()) {
+        return {};
+    }
+    const int term_id = slots_[FindSlot(word, Hash(word))];
+    if (term_id == NO_TERM) {
+        return {};
+    }
+    return { term_id, static_cast<bool>(is_stop_[term_id]) };
+}
+
+// Удаляет обычное слово из словаря. Его id будет выдан другому слову, а текст остается
+// на месте до ReclaimReleasedText
+void TermDictionary::Release(int term_id) {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = FindSlot(words_[term_id], hashes_[term_id]);
+    slots_[slot] = NO_TERM;
+
+    // Сдвигаем назад слова из цепочки проб за освободившейся ячейкой, которые не могут
+    // лежать между своей начальной ячейкой и текущей, чтобы поиск не обрывался на пустой ячейке
+    for (size_t next = (slot + 1) & mask; slots_[next] != NO_TERM; next = (next + 1) & mask) {
+        const size_t home = hashes_[slots_[next]] & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            slots_[slot] = slots_[next];
+            slots_[next] = NO_TERM;
+            slot = next;
+        }
+    }
+
+    if (!is_borrowed_[term_id]) {
+        released_text_.push_back(words_[term_id]);
+    }
+    words_[term_id] = {};
+    free_ids_.push_back(term_id);
+}
+
+// Отдает новым словам место под текст слов, освобожденных с прошлого вызова
+void TermDictionary::ReclaimReleasedText() {
+    for (string_view text : released_text_) {
+        text_.Free(text);
+    }
+    released_text_ = vector<string_view>{};
+}
+
+// Возвращает текст слова, действительный до ReclaimReleasedText после освобождения слова
+string_view TermDictionary::GetWord(int term_id) const {
+    return words_[term_id];
+}
+
+// Возвращает true, если слово - стоп-слово
+bool TermDictionary::IsStopWord(int term_id) const {
+    return is_stop_[term_id];
+}
+
+// Заполняет пустой словарь словами по их id. Текст слов лежит вне словаря (например,
+// в отображенном снимке) и должен пережить его. Пустое слово означает свободный id
+void TermDictionary::Restore(vector<string_view> words, vector<char> is_stop) {
+    words_ = move(words);
+    is_stop_ = move(is_stop);
+    is_borrowed_.assign(words_.size(), true);
+    hashes_.resize(words_.size());
+    free_ids_.clear();
+    for (size_t term_id = words_.size(); term_id-- > 0;) {
+        if (words_[term_id].empty()) {
+            free_ids_.push_back(static_cast<int>(term_id));
+        }
+        else {
+            hashes_[term_id] = Hash(words_[term_id]);
+        }
+    }
+
+    size_t slot_count = 16;
+    while (GetWordCount() * 2 > slot_count) {
+        slot_count *= 2;
+    }
+    Rehash(slot_count);
+}
+
+// Возвращает границу выданных id: все id слов меньше нее
+size_t TermDictionary::Size() const {
+    return words_.size();
+}
+
+// Хэш слова, по которому оно ищется в словаре
+size_t TermDictionary::Hash(string_view word) {
+    return std::hash<string_view>{}(word);
+}
+
+// Возвращает кол-во слов в словаре
+size_t TermDictionary::GetWordCount() const {
+    return words_.size() - free_ids_.size();
+}
+
+// Возвращает ячейку со словом либо пустую ячейку, куда его следует поместить
+size_t TermDictionary::FindSlot(string_view word, size_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = hash & mask;
+    while (slots_[slot] != NO_TERM) {
+        const int term_id = slots_[slot];
+        if (hashes_[term_id] == hash && words_[term_id] == word) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Перестраивает таблицу с заданным кол-вом ячеек
+void TermDictionary::Rehash(size_t slot_count) {
+    slots_.assign(slot_count, NO_TERM);
+    const size_t mask = slot_count - 1;
+    for (size_t term_id = 0; term_id < words_.size(); ++term_id) {
+        if (words_[term_id].empty()) {
+            continue;
+        }
+        size_t slot = hashes_[term_id] & mask;
+        while (slots_[slot] != NO_TERM) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = static_cast<int>(term_id);
+    }
+}
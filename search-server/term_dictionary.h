@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "text_arena.h"
+
+// Словарь слов сервера. Каждое различное слово хранится один раз и получает компактный id,
+// выдаваемый подряд начиная с нуля. Стоп-слова хранятся в том же словаре с признаком is_stop,
+// поэтому разбор слова документа или запроса обходится одним поиском в хэш-таблице.
+// Таблица с открытой адресацией хранит id слов, само слово и его хэш лежат в столбцах по id.
+// Текст слов хранится в TextArena. Освобожденное слово сразу отдает id следующим словам, а ячейку
+// текста - только после ReclaimReleasedText, поэтому выданный текст слова не меняется до этого вызова
+class TermDictionary {
+public:
+    // id отсутствующего в словаре слова
+    static constexpr int NO_TERM = -1;
+
+    struct Term {
+        int id = NO_TERM;
+        bool is_stop = false;
+    };
+
+    // Добавляет стоп-слово
+    void AddStopWord(std::string_view word);
+
+    // Возвращает слово, при отсутствии добавляя его как обычное
+    Term Intern(std::string_view word);
+
+    // Intern с заранее вычисленным хэшем слова (см. Hash)
+    Term Intern(std::string_view word, size_t hash);
+
+    // Хэш слова, по которому оно ищется в словаре
+    static size_t Hash(std::string_view word);
+
+    // Возвращает слово либо Term с id NO_TERM, если его нет в словаре
+    Term Find(std::string_view word) const;
+
+    // Удаляет обычное слово из словаря. Его id будет выдан другому слову, а текст остается
+    // на месте до ReclaimReleasedText
+    void Release(int term_id);
+
+    // Отдает новым словам место под текст слов, освобожденных с прошлого вызова
+    void ReclaimReleasedText();
+
+    // Возвращает текст слова, действительный до ReclaimReleasedText после освобождения слова
+    std::string_view GetWord(int term_id) const;
+
+    // Возвращает true, если слово - стоп-слово
+    bool IsStopWord(int term_id) const;
+
+    // Заполняет пустой словарь словами по их id. Текст слов лежит вне словаря (например,
+    // в отображенном снимке) и должен пережить его. Пустое слово означает свободный id
+    void Restore(std::vector<std::string_view> words, std::vector<char> is_stop);
+
+    // Возвращает границу выданных id: все id слов меньше нее
+    size_t Size() const;
+
+private:
+    TextArena text_;
+
+    // Столбцы по id слова. У освобожденного id текст пуст
+    std::vector<std::string_view> words_;
+    std::vector<size_t> hashes_;
+    std::vector<char> is_stop_;
+    std::vector<char> is_borrowed_; // Текст слова лежит вне text_
+
+    std::vector<int> free_ids_;
+    std::vector<std::string_view> released_text_; // Текст освобожденных слов, еще не отданный text_
+
+    // Ячейки таблицы: id слова либо NO_TERM. Размер - степень двойки
+    std::vector<int> slots_;
+
+    // Возвращает кол-во слов в словаре
+    size_t GetWordCount() const;
+
+    // Возвращает ячейку со словом либо пустую ячейку, куда его следует поместить
+    size_t FindSlot(std::string_view word, size_t hash) const;
+
+    // Перестраивает таблицу с заданным кол-вом ячеек
+    void Rehash(size_t slot_count);
+};
@@ -0,0 +1,62 @@
+#include "text_arena.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// Копирует строку в хранилище
+string_view TextArena::Allocate(string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+
+    char* data = nullptr;
+    if (text.size() > MAX_SMALL_SIZE) {
+        auto block = make_unique<char[]>(text.size());
+        data = block.get();
+        large_blocks_.emplace(data, move(block));
+    }
+    else {
+        const size_t cell_size = GetCellSize(text.size());
+        const size_t size_class = cell_size / ALIGNMENT;
+        if (size_class < free_cells_.size() && !free_cells_[size_class].empty()) {
+            data = free_cells_[size_class].back();
+            free_cells_[size_class].pop_back();
+        }
+        else {
+            if (chunk_used_ + cell_size > CHUNK_SIZE) {
+                chunks_.push_back(make_unique<char[]>(CHUNK_SIZE));
+                chunk_used_ = 0;
+            }
+            data = chunks_.back().get() + chunk_used_;
+            chunk_used_ += cell_size;
+        }
+    }
+
+    copy(text.begin(), text.end(), data);
+    return { data, text.size() };
+}
+
+// Освобождает строку, ранее выданную Allocate
+void TextArena::Free(string_view text) {
+    if (text.empty()) {
+        return;
+    }
+
+    if (text.size() > MAX_SMALL_SIZE) {
+        large_blocks_.erase(text.data());
+        return;
+    }
+
+    const size_t cell_size = GetCellSize(text.size());
+    const size_t size_class = cell_size / ALIGNMENT;
+    if (free_cells_.size() <= size_class) {
+        free_cells_.resize(size_class + 1);
+    }
+    free_cells_[size_class].push_back(const_cast<char*>(text.data()));
+}
+
+// Возвращает размер ячейки под строку заданной длины
+size_t TextArena::GetCellSize(size_t length) {
+    return (length + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
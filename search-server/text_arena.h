@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Хранилище коротких строк. Строки копируются в крупные блоки памяти и никогда не перемещаются,
+// поэтому выданные string_view остаются действительными до освобождения самой строки.
+// Освобожденное место попадает в список свободных ячеек своего размера и переиспользуется
+// следующими строками того же размера. Длинные строки хранятся в отдельных блоках
+// и возвращаются системе при освобождении
+class TextArena {
+public:
+    // Размер блока, из которого нарезаются ячейки
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    // Строки длиннее хранятся в отдельных блоках
+    static const size_t MAX_SMALL_SIZE = 256;
+
+    // Копирует строку в хранилище
+    std::string_view Allocate(std::string_view text);
+
+    // Освобождает строку, ранее выданную Allocate
+    void Free(std::string_view text);
+
+private:
+    // Ячейки выравниваются по ALIGNMENT байт, список свободных ячеек ведется для каждого размера
+    static const size_t ALIGNMENT = 8;
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t chunk_used_ = CHUNK_SIZE; // Занято в последнем блоке
+
+    // Индекс - размер ячейки / ALIGNMENT
+    std::vector<std::vector<char*>> free_cells_;
+
+    std::unordered_map<const char*, std::unique_ptr<char[]>> large_blocks_;
+
+    // Возвращает размер ячейки под строку заданной длины
+    static size_t GetCellSize(size_t length);
+};
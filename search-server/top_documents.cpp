@@ -0,0 +1,69 @@
+#include "top_documents.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Возвращает true, если lhs стоит в выдаче выше rhs:
+// по убыванию релевантности, при равной релевантности - по убыванию рейтинга
+bool IsRankedHigher(const Document& lhs, const Document& rhs) {
+    if (abs(lhs.relevance - rhs.relevance) < DOUBLE_ACCURACY) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+TopDocuments::TopDocuments(size_t max_count)
+    : max_count_(max_count) {
+}
+
+// Предлагает документ в выдачу, O(log max_count)
+void TopDocuments::Add(const Document& document) {
+    if (heap_.size() < max_count_) {
+        heap_.push_back(document);
+        push_heap(heap_.begin(), heap_.end(), IsRankedHigher);
+    }
+    else if (max_count_ > 0 && IsRankedHigher(document, heap_.front())) {
+        // Вытесняем худший из отобранных документов
+        pop_heap(heap_.begin(), heap_.end(), IsRankedHigher);
+        heap_.back() = document;
+        push_heap(heap_.begin(), heap_.end(), IsRankedHigher);
+    }
+}
+
+// Возвращает true, если отобрано max_count документов
+bool TopDocuments::IsFull() const {
+    return heap_.size() == max_count_;
+}
+
+// Возвращает наибольшее кол-во отбираемых документов
+size_t TopDocuments::GetMaxCount() const {
+    return max_count_;
+}
+
+// Возвращает худший из отобранных документов, куча не должна быть пустой
+const Document& TopDocuments::GetWorst() const {
+    return heap_.front();
+}
+
+// Начинает отбор заново, сохраняя память кучи
+void TopDocuments::Reset(size_t max_count) {
+    max_count_ = max_count;
+    heap_.clear();
+}
+
+// Возвращает отобранные документы, упорядоченные от лучшего к худшему, и очищает кучу.
+// Выдача копируется, чтобы куча сохранила память для следующего отбора
+vector<Document> TopDocuments::Extract() {
+    vector<Document> result;
+    ExtractTo(result);
+    return result;
+}
+
+// Записывает в documents отобранные документы от лучшего к худшему и очищает кучу
+void TopDocuments::ExtractTo(vector<Document>& documents) {
+    sort_heap(heap_.begin(), heap_.end(), IsRankedHigher);
+    documents.assign(heap_.begin(), heap_.end());
+    heap_.clear();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "document.h"
+
+const double DOUBLE_ACCURACY = 1e-6; // Точность сравнения десятичных дробей
+
+// Возвращает true, если lhs стоит в выдаче выше rhs:
+// по убыванию релевантности, при равной релевантности - по убыванию рейтинга
+bool IsRankedHigher(const Document& lhs, const Document& rhs);
+
+// Отбирает заданное кол-во лучших документов из потока найденных.
+// Хранит не более max_count документов в куче, на вершине которой худший из отобранных
+class TopDocuments {
+public:
+    explicit TopDocuments(size_t max_count);
+
+    // Предлагает документ в выдачу, O(log max_count)
+    void Add(const Document& document);
+
+    // Возвращает true, если отобрано max_count документов
+    bool IsFull() const;
+
+    // Возвращает наибольшее кол-во отбираемых документов
+    size_t GetMaxCount() const;
+
+    // Возвращает худший из отобранных документов, куча не должна быть пустой
+    const Document& GetWorst() const;
+
+    // Начинает отбор заново, сохраняя память кучи
+    void Reset(size_t max_count);
+
+    // Возвращает отобранные документы, упорядоченные от лучшего к худшему, и очищает кучу
+    std::vector<Document> Extract();
+
+    // Записывает в documents отобранные документы от лучшего к худшему и очищает кучу.
+    // Память documents и кучи переиспользуется
+    void ExtractTo(std::vector<Document>& documents);
+
+private:
+    size_t max_count_;
+    std::vector<Document> heap_;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Код переменной длины (varint): по 7 бит числа в байте, старший бит - признак продолжения.
+// Числа меньше 128 занимают один байт
+
+// Дописывает число в конец буфера
+inline void AppendVarint(std::vector<uint8_t>& data, uint32_t value) {
+    while (value >= 0x80) {
+        data.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+// Читает число и сдвигает указатель за него
+inline uint32_t ReadVarint(const uint8_t*& data) {
+    uint32_t value = *data++;
+    if (value < 0x80) {
+        return value;
+    }
+    value &= 0x7F;
+    for (int shift = 7;; shift += 7) {
+        const uint32_t byte = *data++;
+        value |= (byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}